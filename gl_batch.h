@@ -0,0 +1,285 @@
+#pragma once
+
+//Offscreen batch rendering of many independent jobs for machines without a display (render farms, CI).
+//Every thread gets its own headless EGL context (gl_headless.h) and its own Render_Targets so nothing touches
+// the default framebuffer. Readback of attachment 0 is pipelined: glReadPixels goes into one of readback_depth
+// pixel pack buffers followed by a fence and the pixels are only mapped readback_depth readbacks later, so the
+// GPU keeps rendering while the CPU consumes earlier results. Runs on Mesa llvmpipe.
+//
+//Images bigger than a framebuffer can be (ie. posters) are rendered in tiles of the maximum size. The render callback is
+// then called once per tile and has to apply targets->tile in its vertex shaders (RENDER_TILE_GLSL), and receive
+// is called once per tile with the tiles offset within the image. Pack buffers are sized for one tile so
+// the memory used does not grow with the image size.
+//
+//Jobs are distributed dynamically: each thread takes the next job index when it is ready for one.
+//The callbacks run on the worker threads with that threads context current. Since the contexts are not shared,
+// per thread resources (shaders, meshes) have to be created in thread_init.
+
+#include "gl.h"
+#include "gl_headless.h"
+#include "gl_render_targets.h"
+#include "gl_pixel_format.h"
+#include "../lib/platform.h"
+#include "../lib/log.h"
+#include <stdlib.h>
+
+enum {
+    GL_BATCH_MAX_THREADS = 64,
+    GL_BATCH_MAX_READBACK_DEPTH = 8,
+};
+
+//Renders the given job into targets which are already bound with the viewport set. targets->tile is the part of the image to render.
+typedef void (*GL_Batch_Render_Func)(void* context, i64 job, Render_Targets* targets, i32 thread_index);
+//Receives the pixels of attachment 0 of one tile of a finished job. tile->x, tile->y is the offset of the tile within the whole image.
+//Rows are tightly packed tile->width pixels, bottom row first. pixels are only valid during the call.
+//The tiles of a job are received in order on the thread that rendered it. Without tiling the only tile is the whole image.
+typedef void (*GL_Batch_Receive_Func)(void* context, i64 job, const u8* pixels, const Render_Tile* tile, isize pixel_size, i32 thread_index);
+//Optional setup and teardown of per thread resources
+typedef void (*GL_Batch_Thread_Func)(void* context, i32 thread_index);
+
+typedef struct GL_Batch_Desc {
+    i32 width;                          //can be bigger than GL_MAX_TEXTURE_SIZE / GL_MAX_VIEWPORT_DIMS in which case the jobs are tiled
+    i32 height;
+    i32 sample_count;                   //0 or 1 for no multisampling. Attachment 0 is resolved before readback
+    Render_Target_Attachment_Desc attachments[RENDER_TARGETS_MAX_ATTACHMENTS];
+    i32 attachment_count;               //0 means a single GL_RGBA8 attachment
+    GLenum depth_stencil_format;        //0 for none
+
+    i64 job_count;
+    i32 thread_count;                   //0 means 1
+    i32 readback_depth;                 //tile readbacks in flight per thread. 0 means 3
+
+    i32 gl_major;                       //0 means 4.3
+    i32 gl_minor;
+
+    GL_Batch_Render_Func render;
+    GL_Batch_Receive_Func receive;      //can be NULL if the result is not needed
+    GL_Batch_Thread_Func thread_init;   //can be NULL
+    GL_Batch_Thread_Func thread_deinit; //can be NULL
+    void* context;
+} GL_Batch_Desc;
+
+typedef struct GL_Batch_Stats {
+    i64 jobs_done;
+    i32 thread_count;
+    f64 seconds;
+    f64 jobs_per_second;
+    bool ok;                            //false if any of the contexts or render targets could not be created
+} GL_Batch_Stats;
+
+typedef struct _GL_Batch_Slot {
+    GLuint pack_buffer;     //holds one tile
+    GLsync fence;
+    i64 job;
+    Render_Tile tile;
+    bool is_last_tile;      //the job is done once this slot is received
+} _GL_Batch_Slot;
+
+typedef struct _GL_Batch_Thread {
+    const GL_Batch_Desc* desc;
+    volatile i32* next_job;
+    GL_Headless_Context context;
+    Render_Targets targets;
+    _GL_Batch_Slot slots[GL_BATCH_MAX_READBACK_DEPTH];
+    i32 tile_width;
+    i32 tile_height;
+    i32 index;
+    i64 jobs_done;
+    bool ok;
+} _GL_Batch_Thread;
+
+INTERNAL void _gl_batch_finish_slot(_GL_Batch_Thread* thread, _GL_Batch_Slot* slot, isize pixel_size)
+{
+    if(slot->fence == 0)
+        return;
+
+    GLenum status = GL_TIMEOUT_EXPIRED;
+    do {
+        status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    } while(status == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(slot->fence);
+    slot->fence = 0;
+
+    const GL_Batch_Desc* desc = thread->desc;
+    if(desc->receive)
+    {
+        isize size = (isize) slot->tile.width*slot->tile.height*pixel_size;
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pack_buffer);
+        const u8* pixels = (const u8*) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, (GLsizeiptr) size, GL_MAP_READ_BIT);
+        if(pixels)
+            desc->receive(desc->context, slot->job, pixels, &slot->tile, pixel_size, thread->index);
+        else
+            LOG_ERROR("RENDER", "gl_batch: could not map the readback of job %lli", (long long) slot->job);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+    if(slot->is_last_tile)
+        thread->jobs_done += 1;
+}
+
+INTERNAL void _gl_batch_thread(void* context)
+{
+    _GL_Batch_Thread* thread = (_GL_Batch_Thread*) context;
+    const GL_Batch_Desc* desc = thread->desc;
+    if(gl_headless_context_make_current(&thread->context) == false)
+    {
+        LOG_ERROR("RENDER", "gl_batch: thread %i could not make its context current", thread->index);
+        return;
+    }
+
+    render_targets_query_max_size(&thread->tile_width, &thread->tile_height);
+    thread->tile_width = MIN(thread->tile_width, desc->width);
+    thread->tile_height = MIN(thread->tile_height, desc->height);
+    isize tile_count = render_tile_count(desc->width, desc->height, thread->tile_width, thread->tile_height);
+    thread->ok = render_targets_init(&thread->targets, "gl_batch", thread->tile_width, thread->tile_height, desc->sample_count,
+        desc->attachments, desc->attachment_count, desc->depth_stencil_format);
+
+    GL_Pixel_Format format = desc->attachments[0].format;
+    i32 channels = 0;
+    Pixel_Type pixel_type = pixel_type_from_gl_pixel_format(format, &channels);
+    isize pixel_size = (isize) pixel_type_size(pixel_type)*channels;
+    isize size = (isize) thread->tile_width*thread->tile_height*pixel_size;
+
+    i32 depth = desc->readback_depth;
+    for(i32 i = 0; i < depth; i++)
+    {
+        glGenBuffers(1, &thread->slots[i].pack_buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, thread->slots[i].pack_buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr) size, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    if(thread->ok && desc->thread_init)
+        desc->thread_init(desc->context, thread->index);
+
+    i64 issued = 0;
+    while(thread->ok)
+    {
+        i64 job = platform_atomic_add32(thread->next_job, 1);
+        if(job >= desc->job_count)
+            break;
+
+        for(isize t = 0; t < tile_count; t++)
+        {
+            //Reusing the oldest slot. Its readback was issued depth tiles ago so it is most likely done by now.
+            _GL_Batch_Slot* slot = &thread->slots[issued % depth];
+            _gl_batch_finish_slot(thread, slot, pixel_size);
+
+            Render_Tile tile = render_tile_get(desc->width, desc->height, thread->tile_width, thread->tile_height, t);
+            thread->targets.tile = tile;
+            render_targets_render_begin(&thread->targets);
+            glViewport(0, 0, tile.width, tile.height);
+            desc->render(desc->context, job, &thread->targets, thread->index);
+            render_targets_render_end(&thread->targets);
+            render_targets_resolve(&thread->targets, 0, 0, tile.width, tile.height);
+
+            GLuint read_frame_buff = thread->targets.sample_count > 1 ? thread->targets.resolve_frame_buff : thread->targets.frame_buff;
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, read_frame_buff);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pack_buffer);
+            glReadPixels(0, 0, tile.width, tile.height, format.access_format, format.channel_type, (void*) 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+            slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot->job = job;
+            slot->tile = tile;
+            slot->is_last_tile = t == tile_count - 1;
+            issued += 1;
+        }
+    }
+
+    //Drain in issue order
+    for(i64 i = issued; i < issued + depth; i++)
+        _gl_batch_finish_slot(thread, &thread->slots[i % depth], pixel_size);
+
+    if(thread->ok && desc->thread_deinit)
+        desc->thread_deinit(desc->context, thread->index);
+
+    for(i32 i = 0; i < depth; i++)
+        glDeleteBuffers(1, &thread->slots[i].pack_buffer);
+    render_targets_deinit(&thread->targets);
+    glFinish();
+    gl_headless_context_release_current(&thread->context);
+    gl_context_state_thread_exit();
+}
+
+//Renders all jobs and returns once every result was received. Blocks the calling thread.
+//The EGL context current on the calling thread (if any) is current again when this returns.
+GL_Batch_Stats gl_batch_run(const GL_Batch_Desc* desc_in)
+{
+    GL_Batch_Desc desc = *desc_in;
+    desc.thread_count = MAX(MIN(desc.thread_count, GL_BATCH_MAX_THREADS), 1);
+    desc.readback_depth = desc.readback_depth <= 0 ? 3 : MIN(desc.readback_depth, GL_BATCH_MAX_READBACK_DEPTH);
+    desc.job_count = MIN(desc.job_count, (i64) INT32_MAX - GL_BATCH_MAX_THREADS);
+    if(desc.gl_major <= 0)
+    {
+        desc.gl_major = 4;
+        desc.gl_minor = 3;
+    }
+    if(desc.attachment_count <= 0)
+    {
+        desc.attachment_count = 1;
+        desc.attachments[0].format = gl_pixel_format_from_pixel_type(PIXEL_TYPE_U8, 4);
+    }
+    desc.attachments[0].resolve = true;
+    ASSERT(desc.render != NULL);
+
+    EGLDisplay prev_display = eglGetCurrentDisplay();
+    EGLContext prev_context = eglGetCurrentContext();
+    EGLSurface prev_draw = eglGetCurrentSurface(EGL_DRAW);
+    EGLSurface prev_read = eglGetCurrentSurface(EGL_READ);
+    GL_Context_State* prev_state = gl_context_state_get_bound();
+
+    GL_Batch_Stats stats = {0};
+    stats.thread_count = desc.thread_count;
+    stats.ok = true;
+
+    //Contexts are created here one after the other (gl_headless_context_init also loads the
+    // function pointers which are global) and then handed over to the threads.
+    _GL_Batch_Thread* threads = (_GL_Batch_Thread*) calloc((size_t) desc.thread_count, sizeof(_GL_Batch_Thread));
+    Platform_Thread handles[GL_BATCH_MAX_THREADS] = {0};
+    volatile i32 next_job = 0;
+    i32 created = 0;
+    for(; created < desc.thread_count; created++)
+    {
+        _GL_Batch_Thread* thread = &threads[created];
+        thread->desc = &desc;
+        thread->next_job = &next_job;
+        thread->index = created;
+        if(gl_headless_context_init(&thread->context, desc.gl_major, desc.gl_minor, NULL) == false)
+            break;
+        gl_headless_context_release_current(&thread->context);
+    }
+
+    stats.ok = created == desc.thread_count;
+    i64 start = platform_perf_counter();
+    i32 launched = 0;
+    for(i32 i = 0; i < created; i++)
+    {
+        if(platform_thread_launch(&handles[launched], _gl_batch_thread, &threads[i], 0) == 0)
+            launched += 1;
+        else
+            stats.ok = false;
+    }
+    platform_thread_join(handles, launched);
+    stats.seconds = (f64) (platform_perf_counter() - start) / (f64) platform_perf_counter_frequency();
+
+    for(i32 i = 0; i < created; i++)
+    {
+        stats.jobs_done += threads[i].jobs_done;
+        stats.ok = stats.ok && threads[i].ok;
+        gl_headless_context_deinit(&threads[i].context);
+    }
+    free(threads);
+
+    stats.jobs_per_second = stats.seconds > 0 ? (f64) stats.jobs_done / stats.seconds : 0;
+    if(prev_context != EGL_NO_CONTEXT)
+        eglMakeCurrent(prev_display, prev_draw, prev_read, prev_context);
+    gl_context_state_bind(prev_state);
+
+    LOG_INFO("RENDER", "gl_batch_run: %lli jobs of %i x %i on %i threads in %.3lf s (%.1lf jobs/s)",
+        (long long) stats.jobs_done, desc.width, desc.height, stats.thread_count, stats.seconds, stats.jobs_per_second);
+    return stats;
+}
@@ -0,0 +1,764 @@
+#pragma once
+
+//Benchmarks of this library meant to be compared across commits. Everything runs on whatever context
+// is current (batch rendering creates its own), so together with gl_headless.h it runs on Mesa llvmpipe without any GPU or display.
+//The results are appended to a builder as a single JSON object of the form
+// {"renderer": "...", "benchmarks": [{"name": "...", "iterations": N, "total_s": ..., "mean_us": ..., "mb_per_s": ..., "failed": false}, ...]}
+//Benchmarks that compute something also check the result against a CPU reference and set "failed" when it does not match.
+//The GPU primitives are checked by a separate untimed test (gl_benchmark_gpu_primitives_test) whose entries
+// are named "test_..." and have 0 iterations.
+//
+//Define GL_BENCHMARK_MAIN in exactly one translation unit (alongside the usual JOT_ALL_IMPL)
+// to get a main() that creates a headless context, runs everything and prints the JSON to stdout.
+
+#include "gl.h"
+#include "gl_shader_util.h"
+#include "gl_frame_buffers.h"
+#include "gl_pixel_format.h"
+#include "gl_gpu_primitives.h"
+#include "gl_mip_chain.h"
+#include "gl_batch.h"
+#include "../lib/platform.h"
+#include <stdlib.h>
+#include <math.h>
+
+typedef struct GL_Benchmark_Result {
+    const char* name;
+    isize iterations;
+    f64 total_seconds;
+    f64 bytes; //bytes processed in total. 0 if throughput does not make sense for this benchmark
+    bool failed; //the result did not match the CPU reference
+} GL_Benchmark_Result;
+
+typedef Array(GL_Benchmark_Result) GL_Benchmark_Result_Array;
+
+typedef struct GL_Benchmark_Timer {
+    i64 start;
+} GL_Benchmark_Timer;
+
+GL_Benchmark_Timer gl_benchmark_timer_start()
+{
+    GL_Benchmark_Timer timer = {platform_perf_counter()};
+    return timer;
+}
+
+f64 gl_benchmark_timer_elapsed(GL_Benchmark_Timer timer)
+{
+    return (f64) (platform_perf_counter() - timer.start) / (f64) platform_perf_counter_frequency();
+}
+
+void gl_benchmark_push(GL_Benchmark_Result_Array* results, const char* name, isize iterations, f64 total_seconds, f64 bytes)
+{
+    GL_Benchmark_Result result = {name, iterations, total_seconds, bytes};
+    array_push(results, result);
+    LOG_INFO("BENCH", "%-40s %8lli iters %10.3lf us/iter", name, (long long) iterations, total_seconds / (f64) MAX(iterations, 1) * 1e6);
+}
+
+void gl_benchmark_push_checked(GL_Benchmark_Result_Array* results, const char* name, isize iterations, f64 total_seconds, f64 bytes, bool ok)
+{
+    gl_benchmark_push(results, name, iterations, total_seconds, bytes);
+    array_last(*results)->failed = !ok;
+    if(!ok)
+        LOG_ERROR("BENCH", "%s: failed or does not match the CPU reference", name);
+}
+
+//Appends string as the contents of a JSON string literal. Control characters are dropped.
+INTERNAL void _gl_benchmark_json_escape_into(String_Builder* into, const char* string)
+{
+    for(const char* c = string; *c; c++)
+    {
+        if((u8) *c < 0x20)
+            continue;
+        if(*c == '"' || *c == '\\')
+            format_append_into(into, "\\%c", *c);
+        else
+            format_append_into(into, "%c", *c);
+    }
+}
+
+void gl_benchmark_results_to_json(String_Builder* into, const GL_Benchmark_Result* results, isize count)
+{
+    //The renderer string comes from the driver and can contain anything
+    const char* renderer = (const char*) glGetString(GL_RENDERER);
+    format_append_into(into, "{\"renderer\": \"");
+    _gl_benchmark_json_escape_into(into, renderer ? renderer : "");
+    format_append_into(into, "\", \"benchmarks\": [");
+    for(isize i = 0; i < count; i++)
+    {
+        const GL_Benchmark_Result* result = &results[i];
+        f64 mean_us = result->total_seconds / (f64) MAX(result->iterations, 1) * 1e6;
+        f64 mb_per_s = result->total_seconds > 0 ? result->bytes / result->total_seconds / 1e6 : 0;
+
+        format_append_into(into, "%s\n  {\"name\": \"%s\", \"iterations\": %lli, \"total_s\": %.9lf, \"mean_us\": %.6lf, \"mb_per_s\": %.6lf, \"failed\": %s}",
+            i > 0 ? "," : "", result->name, (long long) result->iterations, result->total_seconds, mean_us, mb_per_s, result->failed ? "true" : "false");
+    }
+    format_append_into(into, "\n]}\n");
+}
+
+INTERNAL const char* _gl_benchmark_vertex =
+    "#version 430 core\n"
+    "layout(location = 0) in vec3 a_pos;\n"
+    "uniform mat4 u_model;\n"
+    "uniform float u_scale;\n"
+    "void main() { gl_Position = u_model * vec4(a_pos * u_scale, 1.0); }\n";
+
+INTERNAL const char* _gl_benchmark_fragment =
+    "#version 430 core\n"
+    "out vec4 o_color;\n"
+    "uniform vec3 u_color;\n"
+    "uniform int u_mode;\n"
+    "void main() { o_color = vec4(u_mode == 0 ? u_color : u_color.bgr, 1.0); }\n";
+
+void gl_benchmark_shader_compile(GL_Benchmark_Result_Array* results, isize iterations)
+{
+    GL_Benchmark_Timer timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+    {
+        GLuint program = shader_compile_render(_gl_benchmark_vertex, _gl_benchmark_fragment, NULL, NULL);
+        ASSERT(program != 0);
+        glDeleteProgram(program);
+    }
+    glFinish();
+    gl_benchmark_push(results, "shader_compile", iterations, gl_benchmark_timer_elapsed(timer), 0);
+}
+
+//Fills the cache with a synthetic shader tree without touching the disk. Returns the total size of all files.
+isize gl_benchmark_make_shader_corpus(Shader_File_Cache* cache, Path directory, isize include_count, isize lines_per_file)
+{
+    isize total_size = 0;
+    SCRATCH_ARENA(arena)
+    {
+        String_Builder root = builder_make(arena.alloc, 0);
+        format_append_into(&root, "#version 430 core\n");
+        for(isize i = 0; i < include_count; i++)
+        {
+            String_Builder file = builder_make(arena.alloc, 0);
+            format_append_into(&file, "//synthetic include %lli\n#define INCLUDE_%lli\n", (long long) i, (long long) i);
+            for(isize line = 0; line < lines_per_file; line++)
+            {
+                if(line % 16 == 0)
+                    format_append_into(&file, "#ifdef VERT\n");
+                else if(line % 16 == 15)
+                    format_append_into(&file, "#endif //VERT\n");
+                else
+                    format_append_into(&file, "    vec4 value_%lli_%lli = texture(u_texture, uv * %lli.0) * vec4(0.5, 0.25, 0.125, 1.0);\n",
+                        (long long) i, (long long) line, (long long) line);
+            }
+
+            String name = format(arena.alloc, "include_%lli.glsl", (long long) i);
+            Path_Builder full_path = path_make_absolute(arena.alloc, directory, path_parse(name));
+            Shader_File_Cache_Entry* entry = &cache->data[_shader_file_cache_add(cache, full_path)];
+            builder_assign(&entry->contents, file.string);
+            entry->has_contents = true;
+            total_size += file.len;
+
+            format_append_into(&root, "#include \"%s\"\n", name.data);
+        }
+        format_append_into(&root, "void main() {}\n");
+
+        Path_Builder full_path = path_make_absolute(arena.alloc, directory, path_parse(STRING("root.glsl")));
+        Shader_File_Cache_Entry* entry = &cache->data[_shader_file_cache_add(cache, full_path)];
+        builder_assign(&entry->contents, root.string);
+        entry->has_contents = true;
+        total_size += root.len;
+    }
+
+    return total_size;
+}
+
+void gl_benchmark_shader_preprocess(GL_Benchmark_Result_Array* results, isize iterations)
+{
+    Shader_File_Cache cache = {0};
+    cache.allocator = allocator_get_default();
+
+    Path directory = path_get_startup_working_directory();
+    Path root = path_parse(STRING("root.glsl"));
+    isize corpus_size = gl_benchmark_make_shader_corpus(&cache, directory, 16, 4096);
+
+    GL_Benchmark_Timer timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+    {
+        for(isize j = 0; j < cache.len; j++)
+        {
+            cache.data[j].has_processed = false;
+            cache.data[j].has_version = false;
+        }
+
+        shader_file_load_into_cache_and_handle_inclusion(&cache, directory, root);
+    }
+    gl_benchmark_push(results, "shader_preprocess", iterations, gl_benchmark_timer_elapsed(timer), (f64) (corpus_size * iterations));
+
+    timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations*100; i++)
+        shader_file_load_into_cache_and_handle_inclusion(&cache, directory, root);
+    gl_benchmark_push(results, "shader_preprocess_cache_hit", iterations*100, gl_benchmark_timer_elapsed(timer), 0);
+
+    shader_file_cache_deinit(&cache);
+    array_deinit(&cache);
+}
+
+void gl_benchmark_shader_set(GL_Benchmark_Result_Array* results, isize iterations)
+{
+    GL_Shader shader = {0};
+    shader.handle = shader_compile_render(_gl_benchmark_vertex, _gl_benchmark_fragment, NULL, NULL);
+    ASSERT(shader.handle != 0);
+
+    Mat4 model = {0};
+    Vec3 color = {0};
+    GL_Benchmark_Timer timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+    {
+        render_shader_set_f32(&shader, "u_scale", (f32) i);
+        render_shader_set_i32(&shader, "u_mode", (i32) i & 1);
+        render_shader_set_vec3(&shader, "u_color", color);
+        render_shader_set_mat4(&shader, "u_model", model);
+    }
+    glFinish();
+    gl_benchmark_push(results, "render_shader_set", iterations*4, gl_benchmark_timer_elapsed(timer), 0);
+
+    render_shader_unuse(&shader);
+    glDeleteProgram(shader.handle);
+}
+
+void gl_benchmark_frame_buffers(GL_Benchmark_Result_Array* results, isize iterations, i32 width, i32 height)
+{
+    Render_Screen_Frame_Buffers buffers = {0};
+    bool ok = true;
+    GL_Benchmark_Timer timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+    {
+        //alternate between two sizes so that every iteration is a real resize
+        i32 shrink = (i32) (i & 1)*16;
+        ok = render_screen_frame_buffers_init(&buffers, width - shrink, height - shrink) && ok;
+    }
+    glFinish();
+    gl_benchmark_push_checked(results, "frame_buffers_init_resize", iterations, gl_benchmark_timer_elapsed(timer), 0, ok);
+    render_screen_frame_buffers_deinit(&buffers);
+
+    enum {MSAA_SAMPLES = 4};
+    Render_Screen_Frame_Buffers_MSAA msaa = {0};
+    ok = true;
+    timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+    {
+        i32 shrink = (i32) (i & 1)*16;
+        ok = render_screen_frame_buffers_msaa_init(&msaa, width - shrink, height - shrink, MSAA_SAMPLES) && ok;
+    }
+    glFinish();
+    gl_benchmark_push_checked(results, "frame_buffers_msaa_init_resize", iterations, gl_benchmark_timer_elapsed(timer), 0, ok);
+
+    //Resolving buffers that failed to allocate would only measure binding framebuffer 0
+    if(render_screen_frame_buffers_msaa_init(&msaa, width, height, MSAA_SAMPLES) == false)
+    {
+        gl_benchmark_push_checked(results, "frame_buffers_msaa_resolve", 0, 0, 0, false);
+        render_screen_frame_buffers_msaa_deinit(&msaa);
+        return;
+    }
+
+    glFinish();
+    timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+    {
+        render_screen_frame_buffers_msaa_render_begin(&msaa);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        render_screen_frame_buffers_msaa_render_end(&msaa);
+        render_screen_frame_buffers_msaa_post_process_begin(&msaa);
+        render_screen_frame_buffers_msaa_post_process_end(&msaa);
+    }
+    glFinish();
+    f64 resolved_bytes = (f64) width * (f64) height * 3 * sizeof(f32) * MSAA_SAMPLES * (f64) iterations;
+    gl_benchmark_push(results, "frame_buffers_msaa_resolve", iterations, gl_benchmark_timer_elapsed(timer), resolved_bytes);
+    render_screen_frame_buffers_msaa_deinit(&msaa);
+}
+
+void gl_benchmark_pixel_format(GL_Benchmark_Result_Array* results, isize iterations, i32 width, i32 height)
+{
+    Pixel_Type types[] = {PIXEL_TYPE_U8, PIXEL_TYPE_U16, PIXEL_TYPE_U32, PIXEL_TYPE_I8, PIXEL_TYPE_I16, PIXEL_TYPE_I32, PIXEL_TYPE_F16, PIXEL_TYPE_F32};
+    GLuint checksum = 0;
+    GL_Benchmark_Timer timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations*1000; i++)
+    {
+        GL_Pixel_Format format = gl_pixel_format_from_pixel_type(types[i % (isize) (sizeof types / sizeof *types)], i % 4 + 1);
+        i32 channels = 0;
+        pixel_type_from_gl_pixel_format(format, &channels);
+        checksum += format.internal_format + (GLuint) channels;
+    }
+    gl_benchmark_push(results, "pixel_format_lookup", iterations*1000, gl_benchmark_timer_elapsed(timer), 0);
+    LOG_DEBUG("BENCH", "pixel_format_lookup checksum %u", checksum);
+
+    //Upload of 8 bit pixels into a float texture, ie. the driver side conversion
+    GL_Pixel_Format source = gl_pixel_format_from_pixel_type(PIXEL_TYPE_U8, 4);
+    isize size = (isize) width * height * 4;
+    u8* pixels = (u8*) malloc((size_t) size);
+    for(isize i = 0; i < size; i++)
+        pixels[i] = (u8) i;
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, width, height);
+    glFinish();
+
+    timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, source.access_format, source.channel_type, pixels);
+    glFinish();
+    gl_benchmark_push(results, "pixel_format_upload_rgba8_to_rgba32f", iterations, gl_benchmark_timer_elapsed(timer), (f64) size * (f64) iterations);
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glDeleteTextures(1, &texture);
+    free(pixels);
+}
+
+INTERNAL bool _gl_benchmark_close(f64 gpu, f64 cpu)
+{
+    //The GPU sums in a different order and in f32 so only relative closeness can be expected
+    return fabs(gpu - cpu) <= 1e-5*MAX(fabs(cpu), 1.0);
+}
+
+enum {
+    _GL_BENCHMARK_BIN_COUNT = 16,
+    _GL_BENCHMARK_RESULT_SUM = 0,
+    _GL_BENCHMARK_RESULT_MIN = 1,
+    _GL_BENCHMARK_RESULT_MAX = 2,
+    _GL_BENCHMARK_RESULT_BINS = 16,
+};
+
+//Kernels, inputs and CPU references shared by gl_benchmark_gpu_primitives_test and gl_benchmark_gpu_primitives
+typedef struct _GL_Benchmark_Primitives {
+    Shader_File_Cache cache;
+    Gpu_Primitives prims;
+
+    isize count;
+    f32* values;
+    GLuint input;
+    GLuint output;
+    GLuint texture;
+
+    f64 cpu_sum;
+    f32 cpu_min;
+    f32 cpu_max;
+    u32 cpu_bins[_GL_BENCHMARK_BIN_COUNT];
+} _GL_Benchmark_Primitives;
+
+INTERNAL void _gl_benchmark_primitives_deinit(_GL_Benchmark_Primitives* bench)
+{
+    glDeleteTextures(1, &bench->texture);
+    glDeleteBuffers(1, &bench->input);
+    glDeleteBuffers(1, &bench->output);
+    free(bench->values);
+
+    gpu_primitives_deinit(&bench->prims);
+    shader_file_cache_deinit(&bench->cache);
+    array_deinit(&bench->cache);
+    memset(bench, 0, sizeof *bench);
+}
+
+INTERNAL bool _gl_benchmark_primitives_init(_GL_Benchmark_Primitives* bench, i32 width, i32 height, String kernel_directory)
+{
+    enum {BIN_COUNT = _GL_BENCHMARK_BIN_COUNT};
+    memset(bench, 0, sizeof *bench);
+    bench->cache.allocator = allocator_get_default();
+    if(gpu_primitives_init(&bench->prims, &bench->cache, kernel_directory, BIN_COUNT, _GL_BENCHMARK_RESULT_BINS + BIN_COUNT) == false)
+    {
+        _gl_benchmark_primitives_deinit(bench);
+        return false;
+    }
+
+    //Small integers so that the CPU and GPU sums are exact (as long as the total fits into the f32 mantissa)
+    // and every value falls exactly into one bin. One outlier on each side checks min, max and the edge bins.
+    isize count = (isize) width * height;
+    f32* values = (f32*) malloc((size_t) count * sizeof(f32));
+    u32 random = 0x9E3779B9;
+    for(isize i = 0; i < count; i++)
+    {
+        random ^= random << 13; random ^= random >> 17; random ^= random << 5;
+        values[i] = (f32) (random % BIN_COUNT);
+    }
+    values[count/3] = -3.5f;
+    values[count/2] = 100.25f;
+
+    bench->count = count;
+    bench->values = values;
+    bench->cpu_min = values[0];
+    bench->cpu_max = values[0];
+    for(isize i = 0; i < count; i++)
+    {
+        bench->cpu_sum += values[i];
+        bench->cpu_min = MIN(bench->cpu_min, values[i]);
+        bench->cpu_max = MAX(bench->cpu_max, values[i]);
+        isize bin = (isize) values[i];
+        bench->cpu_bins[MAX(MIN(bin, BIN_COUNT - 1), 0)] += 1;
+    }
+
+    glGenBuffers(1, &bench->input);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bench->input);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (count*(isize) sizeof(f32)), values, GL_STATIC_DRAW);
+    glGenBuffers(1, &bench->output);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bench->output);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (count*(isize) sizeof(f32)), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glGenTextures(1, &bench->texture);
+    glBindTexture(GL_TEXTURE_2D, bench->texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32F, width, height);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED, GL_FLOAT, values);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+//Checks the reduction, scan and histogram kernels on width*height floats both from a buffer and from a GL_R32F texture
+// against a CPU reference. Nothing is timed. Every check is pushed into results with 0 iterations and
+// "failed" set when it does not match.
+bool gl_benchmark_gpu_primitives_test(GL_Benchmark_Result_Array* results, i32 width, i32 height, String kernel_directory)
+{
+    enum {BIN_COUNT = _GL_BENCHMARK_BIN_COUNT, RESULT_SUM = _GL_BENCHMARK_RESULT_SUM, RESULT_MIN = _GL_BENCHMARK_RESULT_MIN,
+        RESULT_MAX = _GL_BENCHMARK_RESULT_MAX, RESULT_BINS = _GL_BENCHMARK_RESULT_BINS};
+
+    _GL_Benchmark_Primitives bench = {0};
+    if(_gl_benchmark_primitives_init(&bench, width, height, kernel_directory) == false)
+    {
+        gl_benchmark_push_checked(results, "test_gpu_primitives_init", 0, 0, 0, false);
+        return false;
+    }
+
+    Gpu_Primitives* prims = &bench.prims;
+    isize count = bench.count;
+    bool all_ok = true;
+    Gpu_Readback readback = {0};
+    for(isize from_texture = 0; from_texture < 2; from_texture++)
+    {
+        //The results are read back asynchronously the same way a renderer would
+        bool ok = true;
+        if(from_texture)
+        {
+            ok = ok && gpu_reduce_texture(prims, GPU_REDUCE_SUM, bench.texture, 0, count, RESULT_SUM);
+            ok = ok && gpu_reduce_texture(prims, GPU_REDUCE_MIN, bench.texture, 0, count, RESULT_MIN);
+            ok = ok && gpu_reduce_texture(prims, GPU_REDUCE_MAX, bench.texture, 0, count, RESULT_MAX);
+            ok = ok && gpu_histogram_texture(prims, bench.texture, 0, count, 0, BIN_COUNT, RESULT_BINS);
+        }
+        else
+        {
+            ok = ok && gpu_reduce(prims, GPU_REDUCE_SUM, bench.input, count, RESULT_SUM);
+            ok = ok && gpu_reduce(prims, GPU_REDUCE_MIN, bench.input, count, RESULT_MIN);
+            ok = ok && gpu_reduce(prims, GPU_REDUCE_MAX, bench.input, count, RESULT_MAX);
+            ok = ok && gpu_histogram(prims, bench.input, count, 0, BIN_COUNT, RESULT_BINS);
+        }
+
+        u32 gpu_results[RESULT_BINS + BIN_COUNT] = {0};
+        gpu_primitives_readback_begin(prims, &readback, 0, RESULT_BINS + BIN_COUNT);
+        ok = ok && gpu_readback_poll(&readback, gpu_results, true);
+
+        f32 gpu_sum = 0, gpu_min = 0, gpu_max = 0;
+        memcpy(&gpu_sum, &gpu_results[RESULT_SUM], sizeof(f32));
+        memcpy(&gpu_min, &gpu_results[RESULT_MIN], sizeof(f32));
+        memcpy(&gpu_max, &gpu_results[RESULT_MAX], sizeof(f32));
+        bool sum_ok = ok && _gl_benchmark_close(gpu_sum, bench.cpu_sum);
+        bool min_max_ok = ok && gpu_min == bench.cpu_min && gpu_max == bench.cpu_max;
+        bool histogram_ok = ok && memcmp(&gpu_results[RESULT_BINS], bench.cpu_bins, sizeof bench.cpu_bins) == 0;
+
+        gl_benchmark_push_checked(results, from_texture ? "test_gpu_reduce_sum_texture" : "test_gpu_reduce_sum", 0, 0, 0, sum_ok);
+        gl_benchmark_push_checked(results, from_texture ? "test_gpu_reduce_min_max_texture" : "test_gpu_reduce_min_max", 0, 0, 0, min_max_ok);
+        gl_benchmark_push_checked(results, from_texture ? "test_gpu_histogram_texture" : "test_gpu_histogram", 0, 0, 0, histogram_ok);
+        all_ok = all_ok && sum_ok && min_max_ok && histogram_ok;
+    }
+
+    //Scan is checked element wise so it also reads back the whole output
+    f32* scanned = (f32*) malloc((size_t) count * sizeof(f32));
+    bool scan_ok = gpu_scan(prims, bench.input, bench.output, count);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, bench.output);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, (GLsizeiptr) (count*(isize) sizeof(f32)), scanned);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    f64 running = 0;
+    for(isize i = 0; i < count && scan_ok; i++)
+    {
+        scan_ok = _gl_benchmark_close(scanned[i], running);
+        running += bench.values[i];
+    }
+    gl_benchmark_push_checked(results, "test_gpu_scan", 0, 0, 0, scan_ok);
+    all_ok = all_ok && scan_ok;
+
+    free(scanned);
+    gpu_readback_deinit(&readback);
+    _gl_benchmark_primitives_deinit(&bench);
+    return all_ok;
+}
+
+//Times the reduction, scan and histogram kernels on width*height floats both from a buffer and from a GL_R32F texture.
+//All iterations are queued and waited for at once. Correctness is checked separately by gl_benchmark_gpu_primitives_test.
+void gl_benchmark_gpu_primitives(GL_Benchmark_Result_Array* results, isize iterations, i32 width, i32 height, String kernel_directory)
+{
+    enum {BIN_COUNT = _GL_BENCHMARK_BIN_COUNT, RESULT_SUM = _GL_BENCHMARK_RESULT_SUM, RESULT_MIN = _GL_BENCHMARK_RESULT_MIN,
+        RESULT_MAX = _GL_BENCHMARK_RESULT_MAX, RESULT_BINS = _GL_BENCHMARK_RESULT_BINS};
+
+    _GL_Benchmark_Primitives bench = {0};
+    if(_gl_benchmark_primitives_init(&bench, width, height, kernel_directory) == false)
+    {
+        gl_benchmark_push_checked(results, "gpu_primitives_init", 0, 0, 0, false);
+        return;
+    }
+
+    Gpu_Primitives* prims = &bench.prims;
+    isize count = bench.count;
+    f64 bytes = (f64) count * sizeof(f32) * (f64) iterations;
+    for(isize from_texture = 0; from_texture < 2; from_texture++)
+    {
+        GL_Benchmark_Timer timer = gl_benchmark_timer_start();
+        for(isize i = 0; i < iterations; i++)
+        {
+            if(from_texture)
+                gpu_reduce_texture(prims, GPU_REDUCE_SUM, bench.texture, 0, count, RESULT_SUM);
+            else
+                gpu_reduce(prims, GPU_REDUCE_SUM, bench.input, count, RESULT_SUM);
+        }
+        glFinish();
+        gl_benchmark_push(results, from_texture ? "gpu_reduce_sum_texture" : "gpu_reduce_sum", iterations, gl_benchmark_timer_elapsed(timer), bytes);
+
+        //Both reductions per iteration so the input is read twice
+        timer = gl_benchmark_timer_start();
+        for(isize i = 0; i < iterations; i++)
+        {
+            if(from_texture)
+            {
+                gpu_reduce_texture(prims, GPU_REDUCE_MIN, bench.texture, 0, count, RESULT_MIN);
+                gpu_reduce_texture(prims, GPU_REDUCE_MAX, bench.texture, 0, count, RESULT_MAX);
+            }
+            else
+            {
+                gpu_reduce(prims, GPU_REDUCE_MIN, bench.input, count, RESULT_MIN);
+                gpu_reduce(prims, GPU_REDUCE_MAX, bench.input, count, RESULT_MAX);
+            }
+        }
+        glFinish();
+        gl_benchmark_push(results, from_texture ? "gpu_reduce_min_max_texture" : "gpu_reduce_min_max", iterations, gl_benchmark_timer_elapsed(timer), 2*bytes);
+
+        timer = gl_benchmark_timer_start();
+        for(isize i = 0; i < iterations; i++)
+        {
+            if(from_texture)
+                gpu_histogram_texture(prims, bench.texture, 0, count, 0, BIN_COUNT, RESULT_BINS);
+            else
+                gpu_histogram(prims, bench.input, count, 0, BIN_COUNT, RESULT_BINS);
+        }
+        glFinish();
+        gl_benchmark_push(results, from_texture ? "gpu_histogram_texture" : "gpu_histogram", iterations, gl_benchmark_timer_elapsed(timer), bytes);
+    }
+
+    GL_Benchmark_Timer timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+        gpu_scan(prims, bench.input, bench.output, count);
+    glFinish();
+    gl_benchmark_push(results, "gpu_scan", iterations, gl_benchmark_timer_elapsed(timer), bytes);
+
+    _gl_benchmark_primitives_deinit(&bench);
+}
+
+//Full mip chain of a width x height GL_RGBA8 texture with the compute kernel against glGenerateMipmap, and of
+// a GL_R32UI texture (which glGenerateMipmap does not support) with the max filter.
+//Checked against a CPU reference: level 1 of the average and the 1x1 level of the max.
+void gl_benchmark_mip_chain(GL_Benchmark_Result_Array* results, isize iterations, i32 width, i32 height, String kernel_directory)
+{
+    Shader_File_Cache cache = {0};
+    cache.allocator = allocator_get_default();
+    GL_Mip_Chain chain = {0};
+    gl_mip_chain_init(&chain, allocator_get_default(), &cache, kernel_directory);
+
+    isize count = (isize) width * height;
+    u32* texels = (u32*) malloc((size_t) count * sizeof(u32));
+    u32 random = 0x9E3779B9;
+    u32 cpu_max = 0;
+    for(isize i = 0; i < count; i++)
+    {
+        random ^= random << 13; random ^= random >> 17; random ^= random << 5;
+        texels[i] = random;
+        cpu_max = MAX(cpu_max, random);
+    }
+
+    GLuint color = gl_mip_chain_make_texture(width, height, GL_RGBA8);
+    GLuint color_builtin = gl_mip_chain_make_texture(width, height, GL_RGBA8);
+    GLuint integer = gl_mip_chain_make_texture(width, height, GL_R32UI);
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    glBindTexture(GL_TEXTURE_2D, color_builtin);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, texels);
+    glBindTexture(GL_TEXTURE_2D, integer);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT, texels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    //Level 1 of the average within rounding. Odd sizes fold the last row/column into the previous texel.
+    bool average_ok = gl_mip_chain_generate(&chain, color, GL_MIP_FILTER_AVERAGE);
+    i32 level_width = MAX(width/2, 1);
+    i32 level_height = MAX(height/2, 1);
+    u8* level = (u8*) malloc((size_t) level_width * level_height * 4);
+    glBindTexture(GL_TEXTURE_2D, color);
+    glGetTexImage(GL_TEXTURE_2D, 1, GL_RGBA, GL_UNSIGNED_BYTE, level);
+    for(i32 y = 0; y < level_height && average_ok; y++)
+        for(i32 x = 0; x < level_width && average_ok; x++)
+        {
+            i32 extent_x = MIN(width - 2*x, 2) + (width > 1 && width % 2 == 1 && x == level_width - 1);
+            i32 extent_y = MIN(height - 2*y, 2) + (height > 1 && height % 2 == 1 && y == level_height - 1);
+            for(i32 c = 0; c < 4; c++)
+            {
+                f64 sum = 0;
+                for(i32 j = 0; j < extent_y; j++)
+                    for(i32 i = 0; i < extent_x; i++)
+                        sum += ((const u8*) &texels[(isize) (2*y + j)*width + 2*x + i])[c];
+
+                f64 expected = sum / (extent_x*extent_y);
+                average_ok = fabs(level[((isize) y*level_width + x)*4 + c] - expected) <= 1.0;
+            }
+        }
+
+    bool max_ok = gl_mip_chain_generate(&chain, integer, GL_MIP_FILTER_MAX);
+    i32 top_level = 0;
+    while((MAX(width, height) >> (top_level + 1)) > 0)
+        top_level += 1;
+    u32 gpu_max = 0;
+    glBindTexture(GL_TEXTURE_2D, integer);
+    glGetTexImage(GL_TEXTURE_2D, top_level, GL_RED_INTEGER, GL_UNSIGNED_INT, &gpu_max);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    max_ok = max_ok && gpu_max == cpu_max;
+
+    f64 bytes = (f64) count * sizeof(u32) * (f64) iterations;
+    GL_Benchmark_Timer timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+        gl_mip_chain_generate(&chain, color, GL_MIP_FILTER_AVERAGE);
+    glFinish();
+    gl_benchmark_push_checked(results, "mip_chain_rgba8_average", iterations, gl_benchmark_timer_elapsed(timer), bytes, average_ok);
+
+    timer = gl_benchmark_timer_start();
+    glBindTexture(GL_TEXTURE_2D, color_builtin);
+    for(isize i = 0; i < iterations; i++)
+        glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glFinish();
+    gl_benchmark_push(results, "mip_chain_rgba8_glGenerateMipmap", iterations, gl_benchmark_timer_elapsed(timer), bytes);
+
+    timer = gl_benchmark_timer_start();
+    for(isize i = 0; i < iterations; i++)
+        gl_mip_chain_generate(&chain, integer, GL_MIP_FILTER_MAX);
+    glFinish();
+    gl_benchmark_push_checked(results, "mip_chain_r32ui_max", iterations, gl_benchmark_timer_elapsed(timer), bytes, max_ok);
+
+    glDeleteTextures(1, &color);
+    glDeleteTextures(1, &color_builtin);
+    glDeleteTextures(1, &integer);
+    free(texels);
+    free(level);
+
+    gl_mip_chain_deinit(&chain);
+    shader_file_cache_deinit(&cache);
+    array_deinit(&cache);
+}
+
+typedef struct _GL_Benchmark_Batch {
+    volatile i32 mismatches;
+} _GL_Benchmark_Batch;
+
+INTERNAL void _gl_benchmark_batch_render(void* context, i64 job, Render_Targets* targets, i32 thread_index)
+{
+    (void) context; (void) targets; (void) thread_index;
+    glClearColor((f32) (job & 0xFF) / 255.0f, (f32) ((job >> 8) & 0xFF) / 255.0f, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+INTERNAL void _gl_benchmark_batch_receive(void* context, i64 job, const u8* pixels, const Render_Tile* tile, isize pixel_size, i32 thread_index)
+{
+    (void) thread_index;
+    _GL_Benchmark_Batch* batch = (_GL_Benchmark_Batch*) context;
+    const u8* last = pixels + ((isize) tile->width*tile->height - 1)*pixel_size;
+    bool ok = pixels[0] == (u8) (job & 0xFF) && pixels[1] == (u8) ((job >> 8) & 0xFF) && last[0] == pixels[0] && last[3] == 0xFF;
+    if(!ok)
+        platform_atomic_add32(&batch->mismatches, 1);
+}
+
+//Offscreen batch throughput with one and with several threads (each with its own context).
+//mean_us is the time per job so jobs per second is 1e6/mean_us.
+void gl_benchmark_batch(GL_Benchmark_Result_Array* results, isize iterations, i32 width, i32 height)
+{
+    i32 thread_counts[] = {1, 4};
+    const char* names[] = {"batch_offscreen_1_thread", "batch_offscreen_4_threads"};
+    for(isize i = 0; i < 2; i++)
+    {
+        _GL_Benchmark_Batch batch = {0};
+        GL_Batch_Desc desc = {0};
+        desc.width = width;
+        desc.height = height;
+        desc.job_count = iterations;
+        desc.thread_count = thread_counts[i];
+        desc.render = _gl_benchmark_batch_render;
+        desc.receive = _gl_benchmark_batch_receive;
+        desc.context = &batch;
+
+        GL_Batch_Stats stats = gl_batch_run(&desc);
+        bool ok = stats.ok && stats.jobs_done == iterations && batch.mismatches == 0;
+        gl_benchmark_push_checked(results, names[i], stats.jobs_done, stats.seconds, (f64) width*height*4*(f64) stats.jobs_done, ok);
+    }
+}
+
+typedef struct GL_Benchmark_Params {
+    isize iterations;
+    i32 width;
+    i32 height;
+    String kernel_directory; //directory with the *.comp kernels. "shaders" if empty
+} GL_Benchmark_Params;
+
+//Returns false if any of the benchmarks failed its correctness check
+bool gl_benchmark_run_all(String_Builder* json, GL_Benchmark_Params params)
+{
+    if(params.iterations <= 0)
+        params.iterations = 50;
+    if(params.width <= 0 || params.height <= 0)
+    {
+        params.width = 1920;
+        params.height = 1080;
+    }
+    if(params.kernel_directory.len == 0)
+        params.kernel_directory = STRING("shaders");
+
+    GL_Benchmark_Result_Array results = {0};
+    results.allocator = allocator_get_default();
+
+    gl_benchmark_shader_compile(&results, params.iterations);
+    gl_benchmark_shader_preprocess(&results, params.iterations);
+    gl_benchmark_shader_set(&results, params.iterations*100);
+    gl_benchmark_frame_buffers(&results, params.iterations, params.width, params.height);
+    gl_benchmark_pixel_format(&results, params.iterations, params.width, params.height);
+    gl_benchmark_gpu_primitives_test(&results, params.width, params.height, params.kernel_directory);
+    gl_benchmark_gpu_primitives(&results, params.iterations, params.width, params.height, params.kernel_directory);
+    gl_benchmark_mip_chain(&results, params.iterations, params.width, params.height, params.kernel_directory);
+    gl_benchmark_batch(&results, params.iterations*4, params.width/4, params.height/4);
+
+    bool ok = true;
+    for(isize i = 0; i < results.len; i++)
+        ok = ok && results.data[i].failed == false;
+
+    gl_benchmark_results_to_json(json, results.data, results.len);
+    array_deinit(&results);
+    return ok;
+}
+
+#ifdef GL_BENCHMARK_MAIN
+#include "gl_headless.h"
+#include <stdio.h>
+
+int main(int argc, char** argv)
+{
+    GL_Benchmark_Params params = {0};
+    if(argc > 1)
+        params.iterations = atoi(argv[1]);
+
+    GL_Headless_Context context = {0};
+    if(gl_headless_context_init(&context, 4, 3, NULL) == false)
+        return 1;
+
+    String_Builder json = builder_make(allocator_get_default(), 0);
+    bool ok = gl_benchmark_run_all(&json, params);
+    fputs(json.data, stdout);
+
+    builder_deinit(&json);
+    gl_headless_context_deinit(&context);
+    return ok ? 0 : 1;
+}
+#endif
@@ -0,0 +1,385 @@
+#pragma once
+
+//Sub-allocation of a few large GL buffer objects into ranges for vertex, index, uniform and storage data.
+//
+//Long lived data (meshes, material blocks) is allocated by a buddy allocator from heaps of heap_size bytes.
+// When all heaps are full a new one is created. min_block_size is rounded up to a power of two no smaller
+// than the uniform and storage offset alignments, so blocks are naturally aligned to their (power of two) size
+// and any power of two alignment up to the block size comes for free.
+//Transient data (per frame uniforms, streaming vertices) is bump allocated from a ring of frame_count
+// regions of one buffer which is persistently mapped when GL 4.4 is available. The region of a frame is
+// reused frame_count frames later so the caller has to make sure the GPU is done with it by then
+// (see gl_frame_pacing.h).
+//
+//Bind the ranges with gl_buffer_range_bind (glBindBufferRange) or use their offsets in draw calls.
+//New heaps are only created while they fit into the gl_memory budget.
+
+#include "gl.h"
+#include "gl_memory.h"
+#include "../lib/log.h"
+
+typedef struct GL_Buffer_Range {
+    GLuint buffer;
+    isize offset;
+    isize size;
+    u8* mapped; //pointer to the range when the buffer is persistently mapped else NULL
+
+    i32 _heap;  //-1 for transient ranges
+    i32 _block;
+} GL_Buffer_Range;
+
+typedef Array(i32) _GL_Buddy_Index_Array;
+typedef Array(u8) _GL_Buddy_Order_Array;
+
+enum {GL_BUDDY_MAX_ORDERS = 32};
+
+typedef struct _GL_Buddy_Heap {
+    GLuint buffer;
+    i32 max_order;
+    i32 free_heads[GL_BUDDY_MAX_ORDERS]; //first free block of each order or -1
+
+    //Per min block. Only meaningful at the first min block of a block.
+    _GL_Buddy_Index_Array next;
+    _GL_Buddy_Index_Array prev;
+    _GL_Buddy_Order_Array free_order; //order + 1 of the free block starting here or 0
+    _GL_Buddy_Order_Array used_order; //order + 1 of the allocated block starting here or 0
+
+    isize used_bytes;
+} _GL_Buddy_Heap;
+
+typedef Array(_GL_Buddy_Heap) _GL_Buddy_Heap_Array;
+
+typedef struct GL_Buffer_Pool {
+    Allocator* allocator;
+    isize heap_size;
+    isize min_block_size;
+    _GL_Buddy_Heap_Array heaps;
+
+    GLuint transient_buffer;
+    u8* transient_mapped;
+    isize transient_frame_size;
+    i32 transient_frame_count;
+    i32 transient_frame;
+    isize transient_used;
+
+    isize uniform_alignment;
+    isize storage_alignment;
+    bool has_buffer_storage;
+} GL_Buffer_Pool;
+
+isize gl_buffer_align_up(isize value, isize alignment)
+{
+    if(alignment <= 1)
+        return value;
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void gl_buffer_range_bind(GLenum target, GLuint index, GL_Buffer_Range range)
+{
+    glBindBufferRange(target, index, range.buffer, (GLintptr) range.offset, (GLsizeiptr) range.size);
+}
+
+INTERNAL GLuint _gl_buffer_pool_create_buffer(GL_Buffer_Pool* pool, isize size, bool persistent)
+{
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    if(pool->has_buffer_storage)
+    {
+        GLbitfield flags = GL_DYNAMIC_STORAGE_BIT;
+        if(persistent)
+            flags |= GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, (GLsizeiptr) size, NULL, flags);
+    }
+    else
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) size, NULL, persistent ? GL_STREAM_DRAW : GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    gl_memory_track(GL_MEMORY_BUFFER, buffer, size, "GL_Buffer_Pool");
+    return buffer;
+}
+
+INTERNAL void _gl_buddy_push(_GL_Buddy_Heap* heap, i32 block, i32 order)
+{
+    i32 head = heap->free_heads[order];
+    heap->next.data[block] = head;
+    heap->prev.data[block] = -1;
+    if(head != -1)
+        heap->prev.data[head] = block;
+    heap->free_heads[order] = block;
+    heap->free_order.data[block] = (u8) (order + 1);
+}
+
+INTERNAL void _gl_buddy_remove(_GL_Buddy_Heap* heap, i32 block, i32 order)
+{
+    i32 next = heap->next.data[block];
+    i32 prev = heap->prev.data[block];
+    if(prev != -1)
+        heap->next.data[prev] = next;
+    else
+        heap->free_heads[order] = next;
+    if(next != -1)
+        heap->prev.data[next] = prev;
+    heap->free_order.data[block] = 0;
+}
+
+INTERNAL bool _gl_buffer_pool_add_heap(GL_Buffer_Pool* pool)
+{
+    if(gl_memory_check_budget(pool->heap_size, "GL_Buffer_Pool") == false)
+        return false;
+
+    _GL_Buddy_Heap heap = {0};
+    isize block_count = pool->heap_size / pool->min_block_size;
+    while(((isize) 1 << heap.max_order) < block_count)
+        heap.max_order += 1;
+
+    heap.next.allocator = pool->allocator;
+    heap.prev.allocator = pool->allocator;
+    heap.free_order.allocator = pool->allocator;
+    heap.used_order.allocator = pool->allocator;
+    array_resize(&heap.next, block_count);
+    array_resize(&heap.prev, block_count);
+    array_resize(&heap.free_order, block_count);
+    array_resize(&heap.used_order, block_count);
+    memset(heap.free_order.data, 0, (size_t) block_count);
+    memset(heap.used_order.data, 0, (size_t) block_count);
+
+    for(i32 i = 0; i < GL_BUDDY_MAX_ORDERS; i++)
+        heap.free_heads[i] = -1;
+
+    _gl_buddy_push(&heap, 0, heap.max_order);
+    heap.buffer = _gl_buffer_pool_create_buffer(pool, pool->heap_size, false);
+    array_push(&pool->heaps, heap);
+
+    LOG_INFO("RENDER", "gl_buffer_pool: created heap %lli of %lli bytes", (long long) pool->heaps.len - 1, (long long) pool->heap_size);
+    return true;
+}
+
+//min_block_size is rounded up to a power of two at least as big as GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT and
+// GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT. heap_size is rounded up to min_block_size times a power of two.
+//transient_frame_size can be 0 if transient allocations are not needed.
+void gl_buffer_pool_init(GL_Buffer_Pool* pool, Allocator* alloc, isize heap_size, isize min_block_size, isize transient_frame_size, i32 transient_frame_count)
+{
+    memset(pool, 0, sizeof *pool);
+    pool->allocator = alloc;
+    pool->heaps.allocator = alloc;
+    pool->has_buffer_storage = GLAD_GL_VERSION_4_4 != 0;
+
+    GLint uniform_alignment = 0;
+    GLint storage_alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniform_alignment);
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &storage_alignment);
+    pool->uniform_alignment = MAX(uniform_alignment, 1);
+    pool->storage_alignment = MAX(storage_alignment, 1);
+
+    //Block offsets are multiples of min_block_size so it has to be a multiple of both alignments. Those are powers
+    // of two on every implementation, the check below only catches ones that are not.
+    isize required = MAX(min_block_size, MAX(pool->uniform_alignment, pool->storage_alignment));
+    pool->min_block_size = 1;
+    while(pool->min_block_size < required)
+        pool->min_block_size *= 2;
+    if(pool->min_block_size % pool->uniform_alignment != 0 || pool->min_block_size % pool->storage_alignment != 0)
+        LOG_ERROR("RENDER", "gl_buffer_pool_init: offset alignments %lli and %lli are not powers of two. Bound ranges might be misaligned",
+            (long long) pool->uniform_alignment, (long long) pool->storage_alignment);
+
+    isize blocks = 1;
+    while(blocks * pool->min_block_size < heap_size && blocks < ((isize) 1 << (GL_BUDDY_MAX_ORDERS - 1)))
+        blocks *= 2;
+    pool->heap_size = blocks * pool->min_block_size;
+
+    if(transient_frame_size > 0 && transient_frame_count > 0)
+    {
+        pool->transient_frame_size = gl_buffer_align_up(transient_frame_size, pool->min_block_size);
+        pool->transient_frame_count = transient_frame_count;
+
+        isize transient_size = pool->transient_frame_size * transient_frame_count;
+        pool->transient_buffer = _gl_buffer_pool_create_buffer(pool, transient_size, true);
+        if(pool->has_buffer_storage)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, pool->transient_buffer);
+            pool->transient_mapped = (u8*) glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, (GLsizeiptr) transient_size,
+                GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+    }
+}
+
+void gl_buffer_pool_deinit(GL_Buffer_Pool* pool)
+{
+    for(isize i = 0; i < pool->heaps.len; i++)
+    {
+        _GL_Buddy_Heap* heap = &pool->heaps.data[i];
+        gl_memory_untrack(GL_MEMORY_BUFFER, heap->buffer);
+        glDeleteBuffers(1, &heap->buffer);
+        array_deinit(&heap->next);
+        array_deinit(&heap->prev);
+        array_deinit(&heap->free_order);
+        array_deinit(&heap->used_order);
+    }
+    array_deinit(&pool->heaps);
+
+    if(pool->transient_mapped)
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool->transient_buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    gl_memory_untrack(GL_MEMORY_BUFFER, pool->transient_buffer);
+    glDeleteBuffers(1, &pool->transient_buffer);
+    memset(pool, 0, sizeof *pool);
+}
+
+//Allocates a long lived range. Returns a range with size 0 when size exceeds the heap size
+// or a new heap would go over the memory budget.
+GL_Buffer_Range gl_buffer_pool_allocate(GL_Buffer_Pool* pool, isize size, isize alignment)
+{
+    GL_Buffer_Range out = {0};
+    out._heap = -1;
+
+    //Blocks are aligned to their size which is min_block_size (a power of two) times a power of two. So bigger
+    // alignments are satisfied by rounding the size up to the alignment rounded up to a power of two.
+    isize block_alignment = 1;
+    while(block_alignment < alignment)
+        block_alignment *= 2;
+    isize block_bytes = MAX(size, block_alignment > pool->min_block_size ? block_alignment : 1);
+    isize blocks_needed = DIV_CEIL(block_bytes, pool->min_block_size);
+    i32 order = 0;
+    while(((isize) 1 << order) < blocks_needed)
+        order += 1;
+
+    if(size <= 0 || ((isize) 1 << order) * pool->min_block_size > pool->heap_size)
+    {
+        LOG_ERROR("RENDER", "gl_buffer_pool_allocate: invalid size %lli (heap size %lli)", (long long) size, (long long) pool->heap_size);
+        return out;
+    }
+
+    for(isize h = 0; h <= pool->heaps.len; h++)
+    {
+        if(h == pool->heaps.len && _gl_buffer_pool_add_heap(pool) == false)
+            break;
+
+        _GL_Buddy_Heap* heap = &pool->heaps.data[h];
+        i32 found_order = order;
+        while(found_order <= heap->max_order && heap->free_heads[found_order] == -1)
+            found_order += 1;
+
+        if(found_order > heap->max_order)
+            continue;
+
+        i32 block = heap->free_heads[found_order];
+        _gl_buddy_remove(heap, block, found_order);
+        while(found_order > order)
+        {
+            found_order -= 1;
+            _gl_buddy_push(heap, block + (1 << found_order), found_order);
+        }
+
+        heap->used_order.data[block] = (u8) (order + 1);
+        heap->used_bytes += ((isize) 1 << order) * pool->min_block_size;
+
+        out.buffer = heap->buffer;
+        out.offset = (isize) block * pool->min_block_size;
+        out.size = size;
+        out._heap = (i32) h;
+        out._block = block;
+        break;
+    }
+
+    return out;
+}
+
+void gl_buffer_pool_free(GL_Buffer_Pool* pool, GL_Buffer_Range* range)
+{
+    if(range->_heap < 0 || range->size == 0)
+        return;
+
+    _GL_Buddy_Heap* heap = &pool->heaps.data[range->_heap];
+    i32 block = range->_block;
+    i32 order = heap->used_order.data[block] - 1;
+    ASSERT(order >= 0); //double free
+
+    heap->used_order.data[block] = 0;
+    heap->used_bytes -= ((isize) 1 << order) * pool->min_block_size;
+
+    //Merge with free buddies
+    while(order < heap->max_order)
+    {
+        i32 buddy = block ^ (1 << order);
+        if(heap->free_order.data[buddy] != order + 1)
+            break;
+
+        _gl_buddy_remove(heap, buddy, order);
+        block = MIN(block, buddy);
+        order += 1;
+    }
+
+    _gl_buddy_push(heap, block, order);
+    memset(range, 0, sizeof *range);
+    range->_heap = -1;
+}
+
+GL_Buffer_Range gl_buffer_pool_allocate_uniform(GL_Buffer_Pool* pool, isize size)
+{
+    return gl_buffer_pool_allocate(pool, size, pool->uniform_alignment);
+}
+
+GL_Buffer_Range gl_buffer_pool_allocate_storage(GL_Buffer_Pool* pool, isize size)
+{
+    return gl_buffer_pool_allocate(pool, size, pool->storage_alignment);
+}
+
+//Writes data into the range starting at offset bytes from its start.
+void gl_buffer_range_upload(GL_Buffer_Range range, isize offset, const void* data, isize size)
+{
+    ASSERT(offset + size <= range.size);
+    if(range.mapped)
+        memcpy(range.mapped + offset, data, (size_t) size);
+    else
+    {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, range.buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, (GLintptr) (range.offset + offset), (GLsizeiptr) size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+}
+
+//Starts the transient region of the given frame. All transient ranges of the frame frame_count frames ago become invalid.
+void gl_buffer_pool_frame_begin(GL_Buffer_Pool* pool, i64 frame)
+{
+    if(pool->transient_frame_count > 0)
+        pool->transient_frame = (i32) (frame % pool->transient_frame_count);
+    pool->transient_used = 0;
+}
+
+//Bump allocates a range valid until the end of the current frame and fills it with data if not NULL.
+//Returns a range with size 0 when the frame region is exhausted.
+GL_Buffer_Range gl_buffer_pool_allocate_transient(GL_Buffer_Pool* pool, isize size, isize alignment, const void* data_or_null)
+{
+    GL_Buffer_Range out = {0};
+    out._heap = -1;
+
+    //Aligned within the whole buffer, the frame base is only a multiple of min_block_size
+    isize frame_base = pool->transient_frame * pool->transient_frame_size;
+    isize offset = gl_buffer_align_up(frame_base + pool->transient_used, alignment) - frame_base;
+    if(size <= 0 || offset + size > pool->transient_frame_size)
+    {
+        LOG_ERROR("RENDER", "gl_buffer_pool_allocate_transient: out of transient memory (requested %lli used %lli of %lli)",
+            (long long) size, (long long) pool->transient_used, (long long) pool->transient_frame_size);
+        return out;
+    }
+
+    pool->transient_used = offset + size;
+    out.buffer = pool->transient_buffer;
+    out.offset = frame_base + offset;
+    out.size = size;
+    if(pool->transient_mapped)
+        out.mapped = pool->transient_mapped + out.offset;
+
+    if(data_or_null)
+        gl_buffer_range_upload(out, 0, data_or_null, size);
+
+    return out;
+}
+
+GL_Buffer_Range gl_buffer_pool_allocate_transient_uniform(GL_Buffer_Pool* pool, const void* data_or_null, isize size)
+{
+    return gl_buffer_pool_allocate_transient(pool, size, pool->uniform_alignment, data_or_null);
+}
@@ -0,0 +1,351 @@
+#pragma once
+
+//Per GL function call counting and CPU side latency histograms. Works by installing glad pre and post call
+// hooks (requires the glad debug build, same as gl_debug_output_enable) and so covers every entry point.
+//
+//Each thread that calls GL gets its own pair of tables on its first call. The hot path does no allocation and
+// takes no locks - it only hashes the name pointer (glad passes the same string literal every time)
+// and bumps counters. Only the owning thread ever writes its tables: gl_call_stats_frame_end just advances
+// the frame epoch and on its next call the owner retires its table and continues in the other (cleared) one.
+//Retired tables are merged into the report of the next gl_call_stats_frame_end. This means the calls of the thread 
+// calling gl_call_stats_frame_end are reported exactly while calls of other threads land in the report
+// of the first frame end after they made another GL call (or exited).
+//Threads have to call gl_context_state_thread_exit before exiting so that their tables can be reused.
+
+#include "gl.h"
+#include "gl_debug_output.h"
+#include "gl_context_state.h"
+#include "../lib/platform.h"
+#include <stdlib.h>
+
+enum {
+    GL_CALL_STATS_MAX_FUNCTIONS = 2048, //must be power of two. There are only around 1000 GL entry points
+    GL_CALL_STATS_HISTOGRAM_BUCKETS = 32,
+    GL_CALL_STATS_MAX_THREADS = 64,
+};
+
+typedef struct GL_Call_Stat {
+    const char* name;
+    i64 count;
+    i64 total_ns;
+    i64 max_ns;
+    //bucket i counts calls that took [2^i, 2^(i+1)) ns. Bucket 0 also contains calls that took 0ns.
+    i64 histogram[GL_CALL_STATS_HISTOGRAM_BUCKETS];
+} GL_Call_Stat;
+
+typedef Array(GL_Call_Stat) GL_Call_Stat_Array;
+
+typedef struct GL_Call_Stats_Report {
+    i64 frame;
+    i64 total_calls;
+    i64 total_ns;
+    GL_Call_Stat_Array stats; //sorted by count descending
+} GL_Call_Stats_Report;
+
+typedef struct _GL_Call_Stats_Thread {
+    GL_Call_Stat tables[2][GL_CALL_STATS_MAX_FUNCTIONS];
+    i64 call_start;
+    i32 active; //index of the table being counted into. Owner only
+    i32 epoch;  //epoch the active table was started in. Owner only
+
+    volatile i32 retired; //index + 1 of the table waiting to be merged or 0. Set by the owner, cleared by the merge
+    volatile i32 exited;  //set by the owner once it stopped using the tables for good
+} _GL_Call_Stats_Thread;
+
+typedef struct _GL_Call_Stats {
+    Platform_Mutex mutex;
+    _GL_Call_Stats_Thread* threads[GL_CALL_STATS_MAX_THREADS];
+    volatile i32 epoch;
+    i64 frame;
+    f64 ns_per_tick;
+    bool is_init;
+    bool check_errors;
+} _GL_Call_Stats;
+
+static _GL_Call_Stats _gl_call_stats = {0};
+static THREAD_LOCAL _GL_Call_Stats_Thread* _gl_call_stats_thread = NULL;
+
+INTERNAL GL_Call_Stat* _gl_call_stats_slot(GL_Call_Stat* table, const char* name)
+{
+    u64 hash = ((u64) (uintptr_t) name >> 3) * 0x9E3779B97F4A7C15ull;
+    for(u64 i = hash >> 40;; i++)
+    {
+        GL_Call_Stat* stat = &table[i & (GL_CALL_STATS_MAX_FUNCTIONS - 1)];
+        if(stat->name == name || stat->name == NULL)
+        {
+            stat->name = name;
+            return stat;
+        }
+    }
+}
+
+INTERNAL _GL_Call_Stats_Thread* _gl_call_stats_register_thread()
+{
+    _GL_Call_Stats_Thread* thread = NULL;
+    platform_mutex_lock(&_gl_call_stats.mutex);
+    for(i32 i = 0; i < GL_CALL_STATS_MAX_THREADS; i++)
+    {
+        if(_gl_call_stats.threads[i] == NULL)
+        {
+            thread = (_GL_Call_Stats_Thread*) calloc(1, sizeof(_GL_Call_Stats_Thread));
+            if(thread)
+                thread->epoch = platform_atomic_load32(&_gl_call_stats.epoch);
+            _gl_call_stats.threads[i] = thread;
+            break;
+        }
+    }
+    platform_mutex_unlock(&_gl_call_stats.mutex);
+
+    if(thread == NULL)
+        LOG_ERROR(DEBUG_OUTPUT_CHANEL, "Too many threads calling GL. Calls of this thread will not be counted.");
+    return thread;
+}
+
+//Called by the owner when the epoch changed. Retires the active table and continues counting into the other one.
+//If the other table was not merged yet the counting simply continues and the calls are reported a frame later.
+INTERNAL void _gl_call_stats_thread_retire(_GL_Call_Stats_Thread* thread, i32 epoch)
+{
+    if(platform_atomic_load32(&thread->retired) != 0)
+        return;
+
+    i32 next = 1 - thread->active;
+    memset(thread->tables[next], 0, sizeof thread->tables[next]);
+    platform_atomic_store32(&thread->retired, thread->active + 1);
+    thread->active = next;
+    thread->epoch = epoch;
+}
+
+//Gives up the tables of the calling thread. Their contents are merged into the next report.
+void gl_call_stats_thread_exit()
+{
+    _GL_Call_Stats_Thread* thread = _gl_call_stats_thread;
+    _gl_call_stats_thread = NULL;
+    if(thread)
+        platform_atomic_store32(&thread->exited, 1);
+}
+
+static void gl_call_stats_pre_call_gl_callback(const char *name, GLADapiproc apiproc, int len_args, ...)
+{
+    (void) name;
+    (void) apiproc;
+    (void) len_args;
+
+    _GL_Call_Stats_Thread* thread = _gl_call_stats_thread;
+    if(thread == NULL)
+        thread = _gl_call_stats_thread = _gl_call_stats_register_thread();
+
+    if(thread)
+        thread->call_start = platform_perf_counter();
+}
+
+static void gl_call_stats_post_call_gl_callback(void *ret, const char *name, GLADapiproc apiproc, int len_args, ...)
+{
+    i64 now = platform_perf_counter();
+    _GL_Call_Stats_Thread* thread = _gl_call_stats_thread;
+    if(thread)
+    {
+        i32 epoch = platform_atomic_load32(&_gl_call_stats.epoch);
+        if(thread->epoch != epoch)
+            _gl_call_stats_thread_retire(thread, epoch);
+
+        i64 ns = (i64) ((f64) (now - thread->call_start) * _gl_call_stats.ns_per_tick);
+        GL_Call_Stat* stat = _gl_call_stats_slot(thread->tables[thread->active], name);
+
+        i32 bucket = 0;
+        for(u64 rest = (u64) ns >> 1; rest > 0 && bucket < GL_CALL_STATS_HISTOGRAM_BUCKETS - 1; rest >>= 1)
+            bucket += 1;
+
+        stat->count += 1;
+        stat->total_ns += ns;
+        stat->max_ns = MAX(stat->max_ns, ns);
+        stat->histogram[bucket] += 1;
+    }
+
+    if(_gl_call_stats.check_errors)
+        gl_post_call_gl_callback(ret, name, apiproc, len_args);
+}
+
+static void _gl_call_stats_pre_call_noop(const char *name, GLADapiproc apiproc, int len_args, ...)
+{
+    (void) name;
+    (void) apiproc;
+    (void) len_args;
+}
+
+static void _gl_call_stats_post_call_noop(void *ret, const char *name, GLADapiproc apiproc, int len_args, ...)
+{
+    (void) ret;
+    (void) name;
+    (void) apiproc;
+    (void) len_args;
+}
+
+//Starts counting all GL calls. If check_errors is true also checks glGetError after each call just like gl_debug_output_enable.
+void gl_call_stats_enable(bool check_errors)
+{
+    if(_gl_call_stats.is_init == false)
+    {
+        platform_mutex_init(&_gl_call_stats.mutex);
+        _gl_call_stats.ns_per_tick = 1e9 / (f64) platform_perf_counter_frequency();
+        _gl_call_stats.is_init = true;
+        gl_context_state_set_thread_exit_hook(gl_call_stats_thread_exit);
+    }
+
+    _gl_call_stats.check_errors = check_errors;
+    gladSetGLPreCallback(gl_call_stats_pre_call_gl_callback);
+    gladSetGLPostCallback(gl_call_stats_post_call_gl_callback);
+    gladInstallGLDebug();
+}
+
+void gl_call_stats_disable()
+{
+    gladSetGLPreCallback(_gl_call_stats_pre_call_noop);
+    gladSetGLPostCallback(_gl_call_stats.check_errors ? gl_post_call_gl_callback : _gl_call_stats_post_call_noop);
+}
+
+void gl_call_stats_report_deinit(GL_Call_Stats_Report* report)
+{
+    array_deinit(&report->stats);
+    memset(report, 0, sizeof *report);
+}
+
+INTERNAL int _gl_call_stat_compare(const void* a, const void* b)
+{
+    const GL_Call_Stat* stat_a = (const GL_Call_Stat*) a;
+    const GL_Call_Stat* stat_b = (const GL_Call_Stat*) b;
+    if(stat_a->count != stat_b->count)
+        return stat_a->count < stat_b->count ? 1 : -1;
+    return strcmp(stat_a->name, stat_b->name);
+}
+
+INTERNAL void _gl_call_stats_merge_table(GL_Call_Stat* merged, const GL_Call_Stat* table)
+{
+    for(isize i = 0; i < GL_CALL_STATS_MAX_FUNCTIONS; i++)
+    {
+        const GL_Call_Stat* stat = &table[i];
+        if(stat->name == NULL || stat->count == 0)
+            continue;
+
+        GL_Call_Stat* into = _gl_call_stats_slot(merged, stat->name);
+        into->count += stat->count;
+        into->total_ns += stat->total_ns;
+        into->max_ns = MAX(into->max_ns, stat->max_ns);
+        for(isize b = 0; b < GL_CALL_STATS_HISTOGRAM_BUCKETS; b++)
+            into->histogram[b] += stat->histogram[b];
+    }
+}
+
+//Ends the frame and merges all retired counters into report (overriding its previous contents). 
+//See the top of the file for which calls are contained.
+void gl_call_stats_frame_end(GL_Call_Stats_Report* report)
+{
+    if(report->stats.allocator == NULL)
+        report->stats.allocator = allocator_get_default();
+
+    array_clear(&report->stats);
+    report->total_calls = 0;
+    report->total_ns = 0;
+    if(_gl_call_stats.is_init == false)
+        return;
+
+    GL_Call_Stat* merged = (GL_Call_Stat*) calloc(GL_CALL_STATS_MAX_FUNCTIONS, sizeof(GL_Call_Stat));
+    platform_mutex_lock(&_gl_call_stats.mutex);
+    i32 epoch = platform_atomic_add32(&_gl_call_stats.epoch, 1) + 1;
+    _GL_Call_Stats_Thread* self = _gl_call_stats_thread;
+    if(self)
+        _gl_call_stats_thread_retire(self, epoch);
+
+    for(i32 t = 0; t < GL_CALL_STATS_MAX_THREADS; t++)
+    {
+        _GL_Call_Stats_Thread* thread = _gl_call_stats.threads[t];
+        if(thread == NULL)
+            continue;
+
+        i32 retired = platform_atomic_load32(&thread->retired);
+        if(retired != 0)
+        {
+            _gl_call_stats_merge_table(merged, thread->tables[retired - 1]);
+            platform_atomic_store32(&thread->retired, 0);
+        }
+
+        //The owner will not touch the tables anymore so the active one can be merged and the slot reused
+        if(platform_atomic_load32(&thread->exited))
+        {
+            _gl_call_stats_merge_table(merged, thread->tables[thread->active]);
+            _gl_call_stats.threads[t] = NULL;
+            free(thread);
+        }
+    }
+    report->frame = _gl_call_stats.frame++;
+    platform_mutex_unlock(&_gl_call_stats.mutex);
+
+    for(isize i = 0; i < GL_CALL_STATS_MAX_FUNCTIONS; i++)
+    {
+        if(merged[i].count > 0)
+        {
+            array_push(&report->stats, merged[i]);
+            report->total_calls += merged[i].count;
+            report->total_ns += merged[i].total_ns;
+        }
+    }
+
+    free(merged);
+    qsort(report->stats.data, (size_t) report->stats.len, sizeof(GL_Call_Stat), _gl_call_stat_compare);
+}
+
+//Returns the stat of the function with the given name or NULL if it was not called this frame.
+const GL_Call_Stat* gl_call_stats_report_find(const GL_Call_Stats_Report* report, const char* name)
+{
+    for(isize i = 0; i < report->stats.len; i++)
+        if(strcmp(report->stats.data[i].name, name) == 0)
+            return &report->stats.data[i];
+
+    return NULL;
+}
+
+//Returns the latency in ns under which lies the given fraction (0 to 1) of calls. Is only accurate up to the histogram bucket.
+i64 gl_call_stat_percentile_ns(const GL_Call_Stat* stat, f64 fraction)
+{
+    i64 target = (i64) (fraction * (f64) stat->count);
+    i64 seen = 0;
+    for(i32 b = 0; b < GL_CALL_STATS_HISTOGRAM_BUCKETS; b++)
+    {
+        seen += stat->histogram[b];
+        if(seen > target)
+            return MIN((i64) 1 << (b + 1), stat->max_ns);
+    }
+
+    return stat->max_ns;
+}
+
+void gl_call_stats_report_log(const GL_Call_Stats_Report* report, Log_Type log_type, isize max_functions)
+{
+    LOG(log_type, DEBUG_OUTPUT_CHANEL, "Frame %lli: %lli GL calls taking %.3lf ms",
+        (long long) report->frame, (long long) report->total_calls, (f64) report->total_ns / 1e6);
+
+    for(isize i = 0; i < MIN(max_functions, report->stats.len); i++)
+    {
+        const GL_Call_Stat* stat = &report->stats.data[i];
+        LOG(log_type, DEBUG_OUTPUT_CHANEL, "%-32s %8lli calls avg %8.0lf ns p99 %8lli ns max %8lli ns", stat->name, (long long) stat->count,
+            (f64) stat->total_ns / (f64) stat->count, (long long) gl_call_stat_percentile_ns(stat, 0.99), (long long) stat->max_ns);
+    }
+}
+
+//Appends the report as a JSON object, so that call counts can be compared against a baseline in CI.
+void gl_call_stats_report_to_json(String_Builder* into, const GL_Call_Stats_Report* report)
+{
+    format_append_into(into, "{\"frame\": %lli, \"total_calls\": %lli, \"total_ns\": %lli, \"functions\": [",
+        (long long) report->frame, (long long) report->total_calls, (long long) report->total_ns);
+
+    for(isize i = 0; i < report->stats.len; i++)
+    {
+        const GL_Call_Stat* stat = &report->stats.data[i];
+        format_append_into(into, "%s\n  {\"name\": \"%s\", \"count\": %lli, \"total_ns\": %lli, \"max_ns\": %lli, \"histogram_log2_ns\": [",
+            i > 0 ? "," : "", stat->name, (long long) stat->count, (long long) stat->total_ns, (long long) stat->max_ns);
+
+        for(i32 b = 0; b < GL_CALL_STATS_HISTOGRAM_BUCKETS; b++)
+            format_append_into(into, b > 0 ? ", %lli" : "%lli", (long long) stat->histogram[b]);
+        format_append_into(into, "]}");
+    }
+    format_append_into(into, "\n]}\n");
+}
@@ -0,0 +1,509 @@
+#pragma once
+
+//Deferred GL command recording and sorted replay.
+//
+//Commands are recorded into a GL_Command_List without calling GL at all, so any thread can record into its
+// own list in parallel. The GL thread then submits all lists at once: the commands get sorted by their
+// 64 bit key and replayed while skipping every redundant state change (framebuffer, program, vertex array,
+// texture and uniform).
+//
+//Commands with equal keys keep the order in which they were recorded (and the order of the lists).
+//Uniforms are recorded by location because glGetUniformLocation can only be called on the GL thread.
+//Query the locations once at load time.
+//
+//Uniform values stay set on their program after a command executed, and after sorting the previously executed 
+// command with the same program is not necessarily the previously recorded one. So a command has to set every
+// uniform it depends on itself instead of relying on an earlier command (values that did not change are skipped
+// during replay so this is cheap).
+
+#include "gl.h"
+#include "gl_shader_util.h"
+#include <stdlib.h>
+
+enum {
+    GL_COMMAND_MAX_TEXTURES = 8,
+    GL_COMMAND_MAX_CACHED_UNIFORMS = 64,
+};
+
+typedef enum {
+    GL_COMMAND_CLEAR,
+    GL_COMMAND_DRAW_ARRAYS,
+    GL_COMMAND_DRAW_ELEMENTS,
+    GL_COMMAND_DISPATCH_COMPUTE,
+    GL_COMMAND_MEMORY_BARRIER,
+} GL_Command_Type;
+
+typedef enum {
+    GL_UNIFORM_I32,
+    GL_UNIFORM_F32,
+    GL_UNIFORM_VEC3,
+    GL_UNIFORM_MAT3,
+    GL_UNIFORM_MAT4,
+} GL_Uniform_Type;
+
+//The state a command needs bound when it executes.
+typedef struct GL_Command_State {
+    GLuint frame_buff;                              //0 is the default framebuffer
+    GLuint program;
+    GLuint vertex_array;
+    GLuint textures[GL_COMMAND_MAX_TEXTURES];       //bound to the texture unit of the same index. 0 means dont care
+    GLenum texture_targets[GL_COMMAND_MAX_TEXTURES];//0 means GL_TEXTURE_2D
+    i32 viewport[4];                                //x, y, width, height. Zero width means dont care
+} GL_Command_State;
+
+typedef struct GL_Command_Uniform {
+    GLint location;
+    GL_Uniform_Type type;
+    i32 data_from; //index into GL_Command_List.data
+} GL_Command_Uniform;
+
+typedef struct GL_Command {
+    u64 key;
+    GL_Command_Type type;
+    i32 state_index; //index into GL_Command_List.states
+    i32 uniforms_from;
+    i32 uniforms_count;
+
+    union {
+        struct {
+            GLbitfield mask;
+            f32 color[4];
+            f32 depth;
+            i32 stencil;
+        } clear;
+        struct {
+            GLenum mode;
+            GLint first;
+            GLsizei count;
+            GLsizei instances;
+        } draw_arrays;
+        struct {
+            GLenum mode;
+            GLenum type;
+            GLsizei count;
+            GLsizei instances;
+            isize offset;
+        } draw_elements;
+        struct {
+            GLuint groups[3];
+            i32 group_offset_location; //as in GL_Shader
+        } dispatch;
+        struct {
+            GLbitfield barriers;
+        } memory_barrier;
+    };
+} GL_Command;
+
+typedef Array(GL_Command) GL_Command_Array;
+typedef Array(GL_Command_State) GL_Command_State_Array;
+typedef Array(GL_Command_Uniform) GL_Command_Uniform_Array;
+typedef Array(u32) GL_Command_Data_Array;
+
+typedef struct GL_Command_List {
+    GL_Command_Array commands;
+    GL_Command_State_Array states;
+    GL_Command_Uniform_Array uniforms;
+    GL_Command_Data_Array data;
+
+    i32 pending_uniforms_from; //uniforms set since the last draw or dispatch. They get attached to the next one
+} GL_Command_List;
+
+enum {
+    //Passes with this bit set sort by depth before program and textures (see gl_command_key).
+    //Meant for translucent geometry, ie. GL_COMMAND_PASS_DEPTH_MAJOR | 1 for the pass after the opaque pass 1.
+    GL_COMMAND_PASS_DEPTH_MAJOR = 0x80,
+};
+
+//Key layout from most to least significant bits:
+// pass (8) | framebuffer (8) | program (12) | textures (12) | depth (24)
+// pass (8) | framebuffer (8) | depth (24) | program (12) | textures (12)   for passes with GL_COMMAND_PASS_DEPTH_MAJOR
+//Pass orders whole passes (ie. shadow pass before the main pass) and is entirely up to the caller.
+//Depth is expected in [0, 1] and sorts ascending.
+//
+//The order guaranteed after sorting is exactly:
+// - passes in ascending order
+// - within a pass, commands into the same framebuffer keep the order of their keys. In normal passes depth only
+//   orders commands with the same program and textures (front to back by passing depth). In depth major passes
+//   it orders all of them, so passing 1 - depth gives a back to front order for blending.
+// - clears come before the draws into their framebuffer and barriers after everything else in the pass
+// - commands with equal keys keep the order in which they were recorded
+//Only the low bits of the handles are used. Framebuffers (or programs, textures) whose low bits collide share a group,
+// so their commands can be interleaved within the pass. This costs state changes but does not change the relative order
+// of the commands into one framebuffer. Nothing orders commands into different framebuffers of one pass relative to
+// each other, so a command that reads what another framebuffer rendered has to be in a later pass.
+u64 gl_command_key(u8 pass, GLuint frame_buff, GLuint program, GLuint texture, f32 depth)
+{
+    f32 clamped = depth < 0 ? 0 : depth > 1 ? 1 : depth;
+    u64 quantized_depth = (u64) (clamped * (f32) 0xFFFFFF);
+    u64 material = (u64) (program & 0xFFF) << 12 | (u64) (texture & 0xFFF);
+    u64 key = (u64) pass << 56 | (u64) (frame_buff & 0xFF) << 48;
+    if(pass & GL_COMMAND_PASS_DEPTH_MAJOR)
+        return key | quantized_depth << 24 | material;
+    else
+        return key | material << 24 | quantized_depth;
+}
+
+//Folds all bound textures into the texture bits so that commands using the same set of textures end up next to each other.
+//When only the first unit is used small handles stay as they are.
+u64 gl_command_key_from_state(u8 pass, const GL_Command_State* state, f32 depth)
+{
+    u32 textures = state->textures[0];
+    for(i32 t = 1; t < GL_COMMAND_MAX_TEXTURES; t++)
+        if(state->textures[t] != 0)
+            textures = (textures ^ state->textures[t]) * 0x9E3779B1u + (u32) t;
+
+    return gl_command_key(pass, state->frame_buff, state->program, textures ^ (textures >> 12) ^ (textures >> 24), depth);
+}
+
+void gl_command_list_init(GL_Command_List* list, Allocator* alloc)
+{
+    memset(list, 0, sizeof *list);
+    list->commands.allocator = alloc;
+    list->states.allocator = alloc;
+    list->uniforms.allocator = alloc;
+    list->data.allocator = alloc;
+}
+
+void gl_command_list_deinit(GL_Command_List* list)
+{
+    array_deinit(&list->commands);
+    array_deinit(&list->states);
+    array_deinit(&list->uniforms);
+    array_deinit(&list->data);
+    memset(list, 0, sizeof *list);
+}
+
+//Clears the list for reuse while keeping its memory.
+void gl_command_list_reset(GL_Command_List* list)
+{
+    array_clear(&list->commands);
+    array_clear(&list->states);
+    array_clear(&list->uniforms);
+    array_clear(&list->data);
+    list->pending_uniforms_from = 0;
+}
+
+//Sets the state used by all following commands.
+void gl_command_list_set_state(GL_Command_List* list, const GL_Command_State* state)
+{
+    array_push(&list->states, *state);
+}
+
+INTERNAL void _gl_command_list_push_uniform(GL_Command_List* list, GLint location, GL_Uniform_Type type, const void* data, isize size)
+{
+    ASSERT(size % sizeof(u32) == 0);
+    GL_Command_Uniform uniform = {location, type, (i32) list->data.len};
+    array_push(&list->uniforms, uniform);
+
+    isize words = size / (isize) sizeof(u32);
+    array_resize(&list->data, list->data.len + words);
+    memcpy(list->data.data + uniform.data_from, data, (size_t) size);
+}
+
+//Uniforms are set for the next recorded draw or dispatch only. Clears and barriers leave them pending.
+void gl_command_list_set_i32(GL_Command_List* list, GLint location, i32 val)   { _gl_command_list_push_uniform(list, location, GL_UNIFORM_I32, &val, sizeof val); }
+void gl_command_list_set_f32(GL_Command_List* list, GLint location, f32 val)   { _gl_command_list_push_uniform(list, location, GL_UNIFORM_F32, &val, sizeof val); }
+void gl_command_list_set_vec3(GL_Command_List* list, GLint location, Vec3 val) { _gl_command_list_push_uniform(list, location, GL_UNIFORM_VEC3, val.floats, sizeof val.floats); }
+void gl_command_list_set_mat3(GL_Command_List* list, GLint location, Mat3 val) { _gl_command_list_push_uniform(list, location, GL_UNIFORM_MAT3, val.floats, sizeof val.floats); }
+void gl_command_list_set_mat4(GL_Command_List* list, GLint location, Mat4 val) { _gl_command_list_push_uniform(list, location, GL_UNIFORM_MAT4, val.floats, sizeof val.floats); }
+
+INTERNAL GL_Command* _gl_command_list_push(GL_Command_List* list, GL_Command_Type type, u64 key)
+{
+    ASSERT(list->states.len > 0); //gl_command_list_set_state must be called before recording commands
+
+    GL_Command command = {0};
+    command.key = key;
+    command.type = type;
+    command.state_index = (i32) list->states.len - 1;
+
+    //Clears and barriers use no program so uniforms are kept for the next command which does
+    if(type != GL_COMMAND_CLEAR && type != GL_COMMAND_MEMORY_BARRIER)
+    {
+        command.uniforms_from = list->pending_uniforms_from;
+        command.uniforms_count = (i32) list->uniforms.len - list->pending_uniforms_from;
+        list->pending_uniforms_from = (i32) list->uniforms.len;
+    }
+
+    array_push(&list->commands, command);
+    return array_last(list->commands);
+}
+
+void gl_command_list_clear(GL_Command_List* list, u8 pass, GLbitfield mask, Vec4 color, f32 depth, i32 stencil)
+{
+    //program 0 and depth 0 so that clears sort before all draws into the same framebuffer
+    GLuint frame_buff = array_last(list->states)->frame_buff;
+    GL_Command* command = _gl_command_list_push(list, GL_COMMAND_CLEAR, gl_command_key(pass, frame_buff, 0, 0, 0));
+    command->clear.mask = mask;
+    memcpy(command->clear.color, color.floats, sizeof command->clear.color);
+    command->clear.depth = depth;
+    command->clear.stencil = stencil;
+}
+
+void gl_command_list_draw_arrays(GL_Command_List* list, u8 pass, f32 depth, GLenum mode, GLint first, GLsizei count, GLsizei instances)
+{
+    GL_Command_State* state = array_last(list->states);
+    GL_Command* command = _gl_command_list_push(list, GL_COMMAND_DRAW_ARRAYS, gl_command_key_from_state(pass, state, depth));
+    command->draw_arrays.mode = mode;
+    command->draw_arrays.first = first;
+    command->draw_arrays.count = count;
+    command->draw_arrays.instances = MAX(instances, 1);
+}
+
+void gl_command_list_draw_elements(GL_Command_List* list, u8 pass, f32 depth, GLenum mode, GLsizei count, GLenum type, isize offset, GLsizei instances)
+{
+    GL_Command_State* state = array_last(list->states);
+    GL_Command* command = _gl_command_list_push(list, GL_COMMAND_DRAW_ELEMENTS, gl_command_key_from_state(pass, state, depth));
+    command->draw_elements.mode = mode;
+    command->draw_elements.type = type;
+    command->draw_elements.count = count;
+    command->draw_elements.offset = offset;
+    command->draw_elements.instances = MAX(instances, 1);
+}
+
+//Same as compute_shader_dispatch. The program of the current state is ignored.
+void gl_command_list_dispatch(GL_Command_List* list, u8 pass, const GL_Shader* compute_shader, isize size_x, isize size_y, isize size_z)
+{
+    GL_Command_State state = *array_last(list->states);
+    state.program = compute_shader->handle;
+    gl_command_list_set_state(list, &state);
+
+    GL_Command* command = _gl_command_list_push(list, GL_COMMAND_DISPATCH_COMPUTE, gl_command_key_from_state(pass, &state, 0));
+    command->dispatch.groups[0] = (GLuint) MAX(DIV_CEIL(size_x, compute_shader->block_size_size_x), 1);
+    command->dispatch.groups[1] = (GLuint) MAX(DIV_CEIL(size_y, compute_shader->block_size_size_y), 1);
+    command->dispatch.groups[2] = (GLuint) MAX(DIV_CEIL(size_z, compute_shader->block_size_size_z), 1);
+    command->dispatch.group_offset_location = compute_shader->group_offset_location;
+}
+
+//Barriers sort to the very end of the pass (all key bits set) so put work that depends on it into a later pass.
+void gl_command_list_memory_barrier(GL_Command_List* list, u8 pass, GLbitfield barriers)
+{
+    GL_Command* command = _gl_command_list_push(list, GL_COMMAND_MEMORY_BARRIER, (u64) pass << 56 | ((u64) 1 << 56) - 1);
+    command->memory_barrier.barriers = barriers;
+}
+
+typedef struct _GL_Command_Ref {
+    u64 key;
+    i32 list;
+    i32 command;
+} _GL_Command_Ref;
+
+typedef Array(_GL_Command_Ref) _GL_Command_Ref_Array;
+
+INTERNAL int _gl_command_ref_compare(const void* a, const void* b)
+{
+    const _GL_Command_Ref* ref_a = (const _GL_Command_Ref*) a;
+    const _GL_Command_Ref* ref_b = (const _GL_Command_Ref*) b;
+    if(ref_a->key != ref_b->key)
+        return ref_a->key < ref_b->key ? -1 : 1;
+    if(ref_a->list != ref_b->list)
+        return ref_a->list < ref_b->list ? -1 : 1;
+    return ref_a->command < ref_b->command ? -1 : ref_a->command > ref_b->command;
+}
+
+typedef struct GL_Command_Replay_Stats {
+    isize commands;
+    isize frame_buffer_binds;
+    isize program_binds;
+    isize vertex_array_binds;
+    isize texture_binds;
+    isize uniforms_set;
+    isize uniforms_skipped;
+    isize dispatch_failures; //compute dispatches that could not be issued (see compute_shader_dispatch_groups)
+} GL_Command_Replay_Stats;
+
+typedef struct _GL_Command_Cached_Uniform {
+    GLint location;
+    i32 words;
+    const u32* data;
+} _GL_Command_Cached_Uniform;
+
+INTERNAL isize _gl_uniform_type_words(GL_Uniform_Type type)
+{
+    switch(type)
+    {
+        case GL_UNIFORM_I32:  return 1;
+        case GL_UNIFORM_F32:  return 1;
+        case GL_UNIFORM_VEC3: return 3;
+        case GL_UNIFORM_MAT3: return 9;
+        case GL_UNIFORM_MAT4: return 16;
+        default:              return 0;
+    }
+}
+
+//Sorts all commands of the given lists and executes them on the calling (GL) thread.
+//The lists are left as they are so they can be replayed again or reset by their owners.
+//The clear color, depth and stencil values are restored afterwards. Returns how many state changes were actually issued.
+GL_Command_Replay_Stats gl_command_lists_submit(const GL_Command_List* lists, isize list_count)
+{
+    GL_Command_Replay_Stats stats = {0};
+    SCRATCH_ARENA(arena)
+    {
+        _GL_Command_Ref_Array refs = {0};
+        refs.allocator = arena.alloc;
+        for(isize l = 0; l < list_count; l++)
+            for(isize c = 0; c < lists[l].commands.len; c++)
+            {
+                _GL_Command_Ref ref = {lists[l].commands.data[c].key, (i32) l, (i32) c};
+                array_push(&refs, ref);
+            }
+
+        qsort(refs.data, (size_t) refs.len, sizeof *refs.data, _gl_command_ref_compare);
+
+        //(GLuint) -1 forces the first bind
+        GLuint bound_frame_buff = (GLuint) -1;
+        GL_Context_State* context_state = gl_context_state();
+        GLuint bound_program = context_state->used_shader_handle;
+        GLuint bound_vertex_array = (GLuint) -1;
+        GLuint bound_textures[GL_COMMAND_MAX_TEXTURES] = {0};
+        i32 bound_viewport[4] = {0};
+        memset(bound_textures, 0xFF, sizeof bound_textures);
+
+        _GL_Command_Cached_Uniform cached[GL_COMMAND_MAX_CACHED_UNIFORMS] = {0};
+        isize cached_count = 0;
+
+        //Queried before the first clear
+        bool has_clear_values = false;
+        GLfloat clear_color[4] = {0};
+        GLfloat clear_depth = 0;
+        GLint clear_stencil = 0;
+
+        for(isize r = 0; r < refs.len; r++)
+        {
+            const GL_Command_List* list = &lists[refs.data[r].list];
+            const GL_Command* command = &list->commands.data[refs.data[r].command];
+            const GL_Command_State* state = &list->states.data[command->state_index];
+
+            if(state->frame_buff != bound_frame_buff)
+            {
+                glBindFramebuffer(GL_FRAMEBUFFER, state->frame_buff);
+                bound_frame_buff = state->frame_buff;
+                stats.frame_buffer_binds += 1;
+            }
+
+            if(state->viewport[2] != 0 && memcmp(state->viewport, bound_viewport, sizeof bound_viewport) != 0)
+            {
+                glViewport(state->viewport[0], state->viewport[1], state->viewport[2], state->viewport[3]);
+                memcpy(bound_viewport, state->viewport, sizeof bound_viewport);
+            }
+
+            bool needs_program = command->type != GL_COMMAND_CLEAR && command->type != GL_COMMAND_MEMORY_BARRIER;
+            if(needs_program && state->program != bound_program)
+            {
+                glUseProgram(state->program);
+                bound_program = state->program;
+                context_state->used_shader = NULL;
+                context_state->used_shader_handle = state->program;
+                cached_count = 0;
+                stats.program_binds += 1;
+            }
+
+            bool needs_draw_state = command->type == GL_COMMAND_DRAW_ARRAYS || command->type == GL_COMMAND_DRAW_ELEMENTS;
+            if(needs_draw_state && state->vertex_array != bound_vertex_array)
+            {
+                glBindVertexArray(state->vertex_array);
+                bound_vertex_array = state->vertex_array;
+                stats.vertex_array_binds += 1;
+            }
+
+            if(needs_program)
+            {
+                for(i32 t = 0; t < GL_COMMAND_MAX_TEXTURES; t++)
+                {
+                    if(state->textures[t] != 0 && state->textures[t] != bound_textures[t])
+                    {
+                        glActiveTexture(GL_TEXTURE0 + (GLenum) t);
+                        glBindTexture(state->texture_targets[t] ? state->texture_targets[t] : GL_TEXTURE_2D, state->textures[t]);
+                        bound_textures[t] = state->textures[t];
+                        stats.texture_binds += 1;
+                    }
+                }
+            }
+
+            for(i32 u = 0; u < command->uniforms_count; u++)
+            {
+                const GL_Command_Uniform* uniform = &list->uniforms.data[command->uniforms_from + u];
+                const u32* data = list->data.data + uniform->data_from;
+                i32 words = (i32) _gl_uniform_type_words(uniform->type);
+
+                //Skip uniforms whose value is already set on the bound program
+                isize cached_i = 0;
+                for(; cached_i < cached_count; cached_i++)
+                    if(cached[cached_i].location == uniform->location)
+                        break;
+
+                if(cached_i < cached_count && cached[cached_i].words == words && memcmp(cached[cached_i].data, data, (size_t) words*sizeof(u32)) == 0)
+                {
+                    stats.uniforms_skipped += 1;
+                    continue;
+                }
+
+                switch(uniform->type)
+                {
+                    case GL_UNIFORM_I32:  glUniform1i(uniform->location, (GLint) data[0]); break;
+                    case GL_UNIFORM_F32:  glUniform1fv(uniform->location, 1, (const GLfloat*) (const void*) data); break;
+                    case GL_UNIFORM_VEC3: glUniform3fv(uniform->location, 1, (const GLfloat*) (const void*) data); break;
+                    case GL_UNIFORM_MAT3: glUniformMatrix3fv(uniform->location, 1, GL_FALSE, (const GLfloat*) (const void*) data); break;
+                    case GL_UNIFORM_MAT4: glUniformMatrix4fv(uniform->location, 1, GL_FALSE, (const GLfloat*) (const void*) data); break;
+                }
+                stats.uniforms_set += 1;
+
+                if(cached_i == cached_count && cached_count < GL_COMMAND_MAX_CACHED_UNIFORMS)
+                    cached_count += 1;
+                if(cached_i < cached_count)
+                {
+                    _GL_Command_Cached_Uniform cache_entry = {uniform->location, words, data};
+                    cached[cached_i] = cache_entry;
+                }
+            }
+
+            switch(command->type)
+            {
+                case GL_COMMAND_CLEAR: {
+                    if(has_clear_values == false)
+                    {
+                        glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+                        glGetFloatv(GL_DEPTH_CLEAR_VALUE, &clear_depth);
+                        glGetIntegerv(GL_STENCIL_CLEAR_VALUE, &clear_stencil);
+                        has_clear_values = true;
+                    }
+                    glClearColor(command->clear.color[0], command->clear.color[1], command->clear.color[2], command->clear.color[3]);
+                    glClearDepth(command->clear.depth);
+                    glClearStencil(command->clear.stencil);
+                    glClear(command->clear.mask);
+                } break;
+
+                case GL_COMMAND_DRAW_ARRAYS: {
+                    glDrawArraysInstanced(command->draw_arrays.mode, command->draw_arrays.first, command->draw_arrays.count, command->draw_arrays.instances);
+                } break;
+
+                case GL_COMMAND_DRAW_ELEMENTS: {
+                    glDrawElementsInstanced(command->draw_elements.mode, command->draw_elements.count, command->draw_elements.type,
+                        (const void*) (uintptr_t) command->draw_elements.offset, command->draw_elements.instances);
+                } break;
+
+                case GL_COMMAND_DISPATCH_COMPUTE: {
+                    isize groups[3] = {command->dispatch.groups[0], command->dispatch.groups[1], command->dispatch.groups[2]};
+                    if(compute_shader_dispatch_groups("gl_command_list_dispatch", command->dispatch.group_offset_location, groups) == false)
+                        stats.dispatch_failures += 1;
+                } break;
+
+                case GL_COMMAND_MEMORY_BARRIER: {
+                    glMemoryBarrier(command->memory_barrier.barriers);
+                } break;
+            }
+
+            stats.commands += 1;
+        }
+
+        if(has_clear_values)
+        {
+            glClearColor(clear_color[0], clear_color[1], clear_color[2], clear_color[3]);
+            glClearDepth(clear_depth);
+            glClearStencil(clear_stencil);
+        }
+
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    return stats;
+}
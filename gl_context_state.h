@@ -0,0 +1,82 @@
+#pragma once
+
+//State the library caches about a GL context (the used program, queried limits). It lives in a GL_Context_State
+// per context instead of in globals so that several contexts can render on different threads at once.
+//
+//The state of the context current on the calling thread is found through a thread local pointer which is set by
+// gl_context_state_bind right after making the context current (gl_headless_context_make_current does so).
+//When nothing is bound every thread uses its own implicit state, which is correct as long as a thread only ever
+// uses one context (ie. the main thread with the window context). Contexts that move between threads or threads
+// that switch between contexts have to bind the state of the context they make current.
+
+#include "gl.h"
+
+#ifndef THREAD_LOCAL
+    #if defined(_MSC_VER)
+        #define THREAD_LOCAL __declspec(thread)
+    #else
+        #define THREAD_LOCAL __thread
+    #endif
+#endif
+
+typedef struct GL_Shader GL_Shader;
+
+typedef struct Compute_Shader_Limits {
+    int32_t max_group_invocations;
+    int32_t max_group_count[3];
+    int32_t max_group_size[3];
+} Compute_Shader_Limits;
+
+typedef struct GL_Context_State {
+    const GL_Shader* used_shader;
+    GLuint used_shader_handle;
+
+    Compute_Shader_Limits compute_limits;
+    bool has_compute_limits;
+} GL_Context_State;
+
+static THREAD_LOCAL GL_Context_State _gl_thread_context_state = {0};
+static THREAD_LOCAL GL_Context_State* _gl_bound_context_state = NULL;
+
+//Makes state the state of the context current on this thread. NULL goes back to the implicit per thread state.
+void gl_context_state_bind(GL_Context_State* state)
+{
+    _gl_bound_context_state = state;
+}
+
+//Returns the explicitly bound state or NULL
+GL_Context_State* gl_context_state_get_bound()
+{
+    return _gl_bound_context_state;
+}
+
+GL_Context_State* gl_context_state()
+{
+    GL_Context_State* state = _gl_bound_context_state;
+    return state ? state : &_gl_thread_context_state;
+}
+
+//Called by gl_context_state_thread_exit so that modules can release their per thread data (ie. gl_call_stats tables)
+static void (*_gl_thread_exit_hook)(void) = NULL;
+
+void gl_context_state_set_thread_exit_hook(void (*hook)(void))
+{
+    _gl_thread_exit_hook = hook;
+}
+
+//Has to be called by threads that used GL right before they exit (gl_batch and gl_worker threads do so).
+void gl_context_state_thread_exit()
+{
+    if(_gl_thread_exit_hook)
+        _gl_thread_exit_hook();
+
+    _gl_bound_context_state = NULL;
+    memset(&_gl_thread_context_state, 0, sizeof(GL_Context_State));
+}
+
+//Forgets everything cached about the current context. Needed after the context was used
+// behind the libraries back (ie. glUseProgram called directly).
+void gl_context_state_reset()
+{
+    memset(gl_context_state(), 0, sizeof(GL_Context_State));
+}
@@ -1,7 +1,9 @@
 #pragma once
 
 #include "gl.h"
+#include "gl_memory.h"
 #include "../lib/string.h"
+#include <math.h>
 
 typedef struct Render_Screen_Frame_Buffers
 {
@@ -25,19 +27,36 @@ typedef struct Render_Screen_Frame_Buffers_MSAA
 
     i32 width;
     i32 height;
+
+    //set when a render pass already resolved into screen_color_buff so post processing doesnt blit again
+    bool is_resolved;
     
     //used so that this becomes visible to debug_allocator
     // and thus we prevent leaking
     String_Builder name;
 } Render_Screen_Frame_Buffers_MSAA;
 
+//Direct state access (GL 4.5) creates the objects with immutable storage without binding them
+// so that no bound state changes behind the callers back and the driver does not have to revalidate.
+//Contexts below 4.5 use the bind to edit path.
+INTERNAL bool _render_frame_buffers_use_dsa()
+{
+    return GLAD_GL_VERSION_4_5 != 0;
+}
+
 void render_screen_frame_buffers_deinit(Render_Screen_Frame_Buffers* buffer)
 {
-    glBindVertexArray(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    //Deleting a bound framebuffer unbinds it so with DSA there is no need to touch the bindings
+    if(_render_frame_buffers_use_dsa() == false)
+    {
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
 
+    gl_memory_untrack(GL_MEMORY_TEXTURE, buffer->screen_color_buff);
+    gl_memory_untrack(GL_MEMORY_RENDERBUFFER, buffer->render_buff);
     glDeleteFramebuffers(1, &buffer->frame_buff);
-    glDeleteBuffers(1, &buffer->screen_color_buff);
+    glDeleteTextures(1, &buffer->screen_color_buff);
     glDeleteRenderbuffers(1, &buffer->render_buff);
 
     array_deinit(&buffer->name); 
@@ -45,16 +64,63 @@ void render_screen_frame_buffers_deinit(Render_Screen_Frame_Buffers* buffer)
     memset(buffer, 0, sizeof *buffer);
 }
 
-void render_screen_frame_buffers_init(Render_Screen_Frame_Buffers* buffer, i32 width, i32 height)
+INTERNAL void _render_screen_frame_buffers_init_dsa(Render_Screen_Frame_Buffers* buffer, i32 width, i32 height)
+{
+    glCreateFramebuffers(1, &buffer->frame_buff);
+
+    glCreateTextures(GL_TEXTURE_2D, 1, &buffer->screen_color_buff);
+    glTextureStorage2D(buffer->screen_color_buff, 1, GL_RGB32F, width, height);
+    glTextureParameteri(buffer->screen_color_buff, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(buffer->screen_color_buff, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glNamedFramebufferTexture(buffer->frame_buff, GL_COLOR_ATTACHMENT0, buffer->screen_color_buff, 0);
+
+    glCreateRenderbuffers(1, &buffer->render_buff);
+    glNamedRenderbufferStorage(buffer->render_buff, GL_DEPTH24_STENCIL8, width, height);
+    glNamedFramebufferRenderbuffer(buffer->frame_buff, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, buffer->render_buff);
+
+    TEST(glCheckNamedFramebufferStatus(buffer->frame_buff, GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE, "frame buffer creation failed!");
+}
+
+INTERNAL i64 _render_screen_frame_buffers_color_bytes(i32 width, i32 height, i32 sample_count)
+{
+    return gl_memory_texture_bytes(GL_RGB32F, width, height, 1, 1, sample_count);
+}
+
+INTERNAL i64 _render_screen_frame_buffers_depth_bytes(i32 width, i32 height, i32 sample_count)
+{
+    return gl_memory_texture_bytes(GL_DEPTH24_STENCIL8, width, height, 1, 1, sample_count);
+}
+
+INTERNAL void _render_screen_frame_buffers_track(Render_Screen_Frame_Buffers* buffer)
+{
+    const char* name = buffer->name.data;
+    gl_memory_track(GL_MEMORY_TEXTURE, buffer->screen_color_buff, _render_screen_frame_buffers_color_bytes(buffer->width, buffer->height, 1), name);
+    gl_memory_track(GL_MEMORY_RENDERBUFFER, buffer->render_buff, _render_screen_frame_buffers_depth_bytes(buffer->width, buffer->height, 1), name);
+}
+
+//Returns false without creating anything if the buffers would not fit into the gl_memory budget.
+bool render_screen_frame_buffers_init(Render_Screen_Frame_Buffers* buffer, i32 width, i32 height)
 {
     render_screen_frame_buffers_deinit(buffer);
 
     LOG_INFO("RENDER", "render_screen_frame_buffers_init %-4d x %-4d", width, height);
     
+    i64 bytes = _render_screen_frame_buffers_color_bytes(width, height, 1) + _render_screen_frame_buffers_depth_bytes(width, height, 1);
+    if(gl_memory_check_budget(bytes, "Render_Screen_Frame_Buffers") == false)
+        return false;
+
     buffer->width = width;
     buffer->height = height;
     buffer->name = builder_from_cstring(NULL, "Render_Screen_Frame_Buffers");
 
+    glDisable(GL_FRAMEBUFFER_SRGB);
+    if(_render_frame_buffers_use_dsa())
+    {
+        _render_screen_frame_buffers_init_dsa(buffer, width, height);
+        _render_screen_frame_buffers_track(buffer);
+        return true;
+    }
+
     //@NOTE: 
     //The lack of the following line caused me 2 hours of debugging why my application crashed due to NULL ptr 
     //deref in glDrawArrays. I still dont know why this occurs but just for safety its better to leave this here.
@@ -83,8 +149,9 @@ void render_screen_frame_buffers_init(Render_Screen_Frame_Buffers* buffer, i32 w
 
     TEST(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE, "frame buffer creation failed!");
 
-    glDisable(GL_FRAMEBUFFER_SRGB);
     glBindFramebuffer(GL_FRAMEBUFFER, 0); 
+    _render_screen_frame_buffers_track(buffer);
+    return true;
 }
 
 void render_screen_frame_buffers_render_begin(Render_Screen_Frame_Buffers* buffer)
@@ -120,31 +187,101 @@ void render_screen_frame_buffers_post_process_end(Render_Screen_Frame_Buffers* b
 
 void render_screen_frame_buffers_msaa_deinit(Render_Screen_Frame_Buffers_MSAA* buffer)
 {
-    glBindVertexArray(0);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    //Deleting a bound framebuffer unbinds it so with DSA there is no need to touch the bindings
+    if(_render_frame_buffers_use_dsa() == false)
+    {
+        glBindVertexArray(0);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
 
+    gl_memory_untrack(GL_MEMORY_TEXTURE, buffer->map_color_multisampled_buff);
+    gl_memory_untrack(GL_MEMORY_RENDERBUFFER, buffer->render_buff);
+    gl_memory_untrack(GL_MEMORY_TEXTURE, buffer->screen_color_buff);
     glDeleteFramebuffers(1, &buffer->frame_buff);
-    glDeleteBuffers(1, &buffer->map_color_multisampled_buff);
+    glDeleteTextures(1, &buffer->map_color_multisampled_buff);
     glDeleteRenderbuffers(1, &buffer->render_buff);
     glDeleteFramebuffers(1, &buffer->intermediate_frame_buff);
-    glDeleteBuffers(1, &buffer->screen_color_buff);
+    glDeleteTextures(1, &buffer->screen_color_buff);
 
     array_deinit(&buffer->name);
 
     memset(buffer, 0, sizeof *buffer);
 }
 
+INTERNAL bool _render_screen_frame_buffers_msaa_init_dsa(Render_Screen_Frame_Buffers_MSAA* buffer, i32 width, i32 height, i32 sample_count)
+{
+    bool state = true;
+    glCreateFramebuffers(1, &buffer->frame_buff);
+
+    glCreateTextures(GL_TEXTURE_2D_MULTISAMPLE, 1, &buffer->map_color_multisampled_buff);
+    glTextureStorage2DMultisample(buffer->map_color_multisampled_buff, sample_count, GL_RGB32F, width, height, GL_TRUE);
+    glNamedFramebufferTexture(buffer->frame_buff, GL_COLOR_ATTACHMENT0, buffer->map_color_multisampled_buff, 0);
+
+    glCreateRenderbuffers(1, &buffer->render_buff);
+    glNamedRenderbufferStorageMultisample(buffer->render_buff, sample_count, GL_DEPTH24_STENCIL8, width, height);
+    glNamedFramebufferRenderbuffer(buffer->frame_buff, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, buffer->render_buff);
+
+    if (glCheckNamedFramebufferStatus(buffer->frame_buff, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        LOG_ERROR("RENDER", "frame buffer creation failed!");
+        ASSERT(false);
+        state = false;
+    }
+
+    glCreateFramebuffers(1, &buffer->intermediate_frame_buff);
+    glCreateTextures(GL_TEXTURE_2D, 1, &buffer->screen_color_buff);
+    glTextureStorage2D(buffer->screen_color_buff, 1, GL_RGB32F, width, height);
+    glTextureParameteri(buffer->screen_color_buff, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(buffer->screen_color_buff, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glNamedFramebufferTexture(buffer->intermediate_frame_buff, GL_COLOR_ATTACHMENT0, buffer->screen_color_buff, 0);
+
+    if (glCheckNamedFramebufferStatus(buffer->intermediate_frame_buff, GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        LOG_ERROR("RENDER", "frame buffer creation failed!");
+        ASSERT(false);
+        state = false;
+    }
+
+    return state;
+}
+
+INTERNAL i64 _render_screen_frame_buffers_msaa_bytes(i32 width, i32 height, i32 sample_count)
+{
+    return _render_screen_frame_buffers_color_bytes(width, height, sample_count) 
+        + _render_screen_frame_buffers_depth_bytes(width, height, sample_count)
+        + _render_screen_frame_buffers_color_bytes(width, height, 1);
+}
+
+INTERNAL void _render_screen_frame_buffers_msaa_track(Render_Screen_Frame_Buffers_MSAA* buffer, i32 sample_count)
+{
+    const char* name = buffer->name.data;
+    gl_memory_track(GL_MEMORY_TEXTURE, buffer->map_color_multisampled_buff, _render_screen_frame_buffers_color_bytes(buffer->width, buffer->height, sample_count), name);
+    gl_memory_track(GL_MEMORY_RENDERBUFFER, buffer->render_buff, _render_screen_frame_buffers_depth_bytes(buffer->width, buffer->height, sample_count), name);
+    gl_memory_track(GL_MEMORY_TEXTURE, buffer->screen_color_buff, _render_screen_frame_buffers_color_bytes(buffer->width, buffer->height, 1), name);
+}
+
+//Returns false without creating anything if the buffers would not fit into the gl_memory budget.
 bool render_screen_frame_buffers_msaa_init(Render_Screen_Frame_Buffers_MSAA* buffer, i32 width, i32 height, i32 sample_count)
 {
     render_screen_frame_buffers_msaa_deinit(buffer);
     LOG_INFO("RENDER", "render_screen_frame_buffers_msaa_init %-4d x %-4d samples: %d", width, height, sample_count);
 
-    glBindVertexArray(0);
+    if(gl_memory_check_budget(_render_screen_frame_buffers_msaa_bytes(width, height, sample_count), "Render_Screen_Frame_Buffers_MSAA") == false)
+        return false;
 
     buffer->width = width;
     buffer->height = height;
     buffer->name = builder_from_cstring(NULL, "Render_Screen_Frame_Buffers_MSAA");
 
+    if(_render_frame_buffers_use_dsa())
+    {
+        bool state = _render_screen_frame_buffers_msaa_init_dsa(buffer, width, height, sample_count);
+        _render_screen_frame_buffers_msaa_track(buffer, sample_count);
+        return state;
+    }
+
+    glBindVertexArray(0);
+
     bool state = true;
     glGenFramebuffers(1, &buffer->frame_buff);
     glBindFramebuffer(GL_FRAMEBUFFER, buffer->frame_buff);
@@ -191,11 +328,13 @@ bool render_screen_frame_buffers_msaa_init(Render_Screen_Frame_Buffers_MSAA* buf
     }
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    return false;
+    _render_screen_frame_buffers_msaa_track(buffer, sample_count);
+    return state;
 }
 
 void render_screen_frame_buffers_msaa_render_begin(Render_Screen_Frame_Buffers_MSAA* buffer)
 {
+    buffer->is_resolved = false;
     glBindFramebuffer(GL_FRAMEBUFFER, buffer->frame_buff); 
         
     glEnable(GL_DEPTH_TEST);
@@ -213,9 +352,12 @@ void render_screen_frame_buffers_msaa_render_end(Render_Screen_Frame_Buffers_MSA
 void render_screen_frame_buffers_msaa_post_process_begin(Render_Screen_Frame_Buffers_MSAA* buffer)
 {
     // 2. now blit multisampled buffer(s) to normal colorbuffer of intermediate FBO. Image_Builder is stored in screenTexture
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, buffer->frame_buff);
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, buffer->intermediate_frame_buff);
-    glBlitFramebuffer(0, 0, buffer->width, buffer->height, 0, 0, buffer->width, buffer->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    if(buffer->is_resolved == false)
+    {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, buffer->frame_buff);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, buffer->intermediate_frame_buff);
+        glBlitFramebuffer(0, 0, buffer->width, buffer->height, 0, 0, buffer->width, buffer->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
     
     glBindFramebuffer(GL_FRAMEBUFFER, 0); // back to default
     glDisable(GL_DEPTH_TEST);
@@ -225,4 +367,318 @@ void render_screen_frame_buffers_msaa_post_process_begin(Render_Screen_Frame_Buf
 void render_screen_frame_buffers_msaa_post_process_end(Render_Screen_Frame_Buffers_MSAA* buffer)
 {
     (void) buffer;
-}
\ No newline at end of file
+}
+
+//Render passes: declare upfront what happens to the old contents of each attachment (load action) and to the 
+// rendered contents once the pass ends (store action) so that the driver does not have to load or keep data 
+// nobody needs. Discarding is done through glInvalidateFramebuffer and is skipped on contexts below 4.3.
+typedef enum {
+    RENDER_PASS_LOAD,       //keep the previous contents
+    RENDER_PASS_CLEAR,      //clear to the clear value
+    RENDER_PASS_DONT_CARE,  //the previous contents are undefined. Use when every pixel gets overwritten anyway
+} Render_Pass_Load_Action;
+
+typedef enum {
+    RENDER_PASS_STORE,      //keep the rendered contents
+    RENDER_PASS_RESOLVE,    //resolve the multisampled contents (only the dirty rect) and discard them afterwards. Same as STORE when not multisampled 
+    RENDER_PASS_DISCARD,    //the rendered contents are not needed after the pass (ie. depth buffers)
+} Render_Pass_Store_Action;
+
+typedef struct Render_Pass {
+    Render_Pass_Load_Action  color_load;
+    Render_Pass_Store_Action color_store;
+    Render_Pass_Load_Action  depth_stencil_load;
+    Render_Pass_Store_Action depth_stencil_store;
+
+    f32 clear_color[4];
+    f32 clear_depth;
+    i32 clear_stencil;
+
+    //The region that was rendered into during this pass. Only this part gets resolved. 
+    //Zero width or height means the whole buffer.
+    i32 dirty_x;
+    i32 dirty_y;
+    i32 dirty_width;
+    i32 dirty_height;
+} Render_Pass;
+
+INTERNAL void _render_pass_invalidate(GLenum target, bool color, bool depth_stencil)
+{
+    GLenum attachments[2] = {0};
+    GLsizei count = 0;
+    if(color)
+        attachments[count++] = GL_COLOR_ATTACHMENT0;
+    if(depth_stencil)
+        attachments[count++] = GL_DEPTH_STENCIL_ATTACHMENT;
+
+    if(count > 0 && GLAD_GL_VERSION_4_3)
+        glInvalidateFramebuffer(target, count, attachments);
+}
+
+INTERNAL void _render_pass_load(const Render_Pass* pass)
+{
+    _render_pass_invalidate(GL_FRAMEBUFFER, pass->color_load == RENDER_PASS_DONT_CARE, pass->depth_stencil_load == RENDER_PASS_DONT_CARE);
+    if(pass->color_load == RENDER_PASS_CLEAR)
+        glClearBufferfv(GL_COLOR, 0, pass->clear_color);
+    if(pass->depth_stencil_load == RENDER_PASS_CLEAR)
+        glClearBufferfi(GL_DEPTH_STENCIL, 0, pass->clear_depth, pass->clear_stencil);
+}
+
+INTERNAL void _render_pass_dirty_rect(const Render_Pass* pass, i32 width, i32 height, i32 rect[4])
+{
+    if(pass->dirty_width <= 0 || pass->dirty_height <= 0)
+    {
+        rect[0] = 0; rect[1] = 0; 
+        rect[2] = width; rect[3] = height;
+    }
+    else
+    {
+        rect[0] = MAX(pass->dirty_x, 0);
+        rect[1] = MAX(pass->dirty_y, 0);
+        rect[2] = MIN(pass->dirty_x + pass->dirty_width, width);
+        rect[3] = MIN(pass->dirty_y + pass->dirty_height, height);
+    }
+}
+
+void render_screen_frame_buffers_pass_begin(Render_Screen_Frame_Buffers* buffer, const Render_Pass* pass)
+{
+    render_screen_frame_buffers_render_begin(buffer);
+    _render_pass_load(pass);
+}
+
+void render_screen_frame_buffers_pass_end(Render_Screen_Frame_Buffers* buffer, const Render_Pass* pass)
+{
+    _render_pass_invalidate(GL_FRAMEBUFFER, pass->color_store == RENDER_PASS_DISCARD, pass->depth_stencil_store == RENDER_PASS_DISCARD);
+    render_screen_frame_buffers_render_end(buffer);
+}
+
+void render_screen_frame_buffers_msaa_pass_begin(Render_Screen_Frame_Buffers_MSAA* buffer, const Render_Pass* pass)
+{
+    render_screen_frame_buffers_msaa_render_begin(buffer);
+    _render_pass_load(pass);
+}
+
+//Executes the store actions. When color is resolved the following render_screen_frame_buffers_msaa_post_process_begin 
+// does not blit again.
+void render_screen_frame_buffers_msaa_pass_end(Render_Screen_Frame_Buffers_MSAA* buffer, const Render_Pass* pass)
+{
+    if(pass->color_store == RENDER_PASS_RESOLVE)
+    {
+        i32 rect[4] = {0};
+        _render_pass_dirty_rect(pass, buffer->width, buffer->height, rect);
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, buffer->frame_buff);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, buffer->intermediate_frame_buff);
+        if(rect[2] > rect[0] && rect[3] > rect[1])
+            glBlitFramebuffer(rect[0], rect[1], rect[2], rect[3], rect[0], rect[1], rect[2], rect[3], GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        buffer->is_resolved = true;
+    }
+    else
+        glBindFramebuffer(GL_FRAMEBUFFER, buffer->frame_buff);
+
+    //The multisampled depth stencil cannot be resolved into anything so RESOLVE means discard for it
+    bool discard_color = pass->color_store != RENDER_PASS_STORE;
+    bool discard_depth_stencil = pass->depth_stencil_store != RENDER_PASS_STORE;
+    _render_pass_invalidate(pass->color_store == RENDER_PASS_RESOLVE ? GL_READ_FRAMEBUFFER : GL_FRAMEBUFFER, discard_color, discard_depth_stencil);
+
+    render_screen_frame_buffers_msaa_render_end(buffer);
+}
+
+//Dynamic resolution: the scene is rendered into the bottom left part of a framebuffer allocated once at 
+// max_scale * window size. How big that part is gets chosen every frame from the measured GPU time of the 
+// previous frames (GL_TIME_ELAPSED queries) so that the frame time stays within the budget. Changing 
+// the scale never reallocates. The post process step then samples the rendered part with uv_scale
+// (or calls render_screen_frame_buffers_dynamic_upscale_to_screen) to upscale it to the window.
+//Because of the timer query render_begin/render_end cannot be nested inside other GL_TIME_ELAPSED queries.
+enum {RENDER_DYNAMIC_RESOLUTION_QUERIES = 4};
+
+typedef struct Render_Screen_Frame_Buffers_Dynamic {
+    Render_Screen_Frame_Buffers buffers;
+
+    i32 window_width;
+    i32 window_height;
+    i32 render_width;  //the part of buffers that is rendered to this frame
+    i32 render_height;
+
+    f32 scale;         //render_width / window_width
+    f32 min_scale;
+    f32 max_scale;
+    f32 uv_scale[2];   //render size / allocated size. Multiply uvs by this when sampling buffers.screen_color_buff
+
+    f64 target_gpu_ms;
+    f64 smoothed_gpu_ms;
+    f64 smoothed_unit_gpu_ms; //smoothed GPU time divided by scale^2 of the frame it was measured at
+
+    GLuint queries[RENDER_DYNAMIC_RESOLUTION_QUERIES];
+    f32 query_scales[RENDER_DYNAMIC_RESOLUTION_QUERIES]; //the scale each query was measuring
+    i64 frames_begun;
+    i64 frames_measured;
+} Render_Screen_Frame_Buffers_Dynamic;
+
+void render_screen_frame_buffers_dynamic_deinit(Render_Screen_Frame_Buffers_Dynamic* buffer)
+{
+    render_screen_frame_buffers_deinit(&buffer->buffers);
+    if(buffer->queries[0])
+        glDeleteQueries(RENDER_DYNAMIC_RESOLUTION_QUERIES, buffer->queries);
+
+    memset(buffer, 0, sizeof *buffer);
+}
+
+INTERNAL void _render_screen_frame_buffers_dynamic_update_size(Render_Screen_Frame_Buffers_Dynamic* buffer)
+{
+    //Nothing is allocated after a failed resize so there is nothing to render into
+    if(buffer->buffers.width <= 0 || buffer->buffers.height <= 0)
+    {
+        buffer->render_width = 0;
+        buffer->render_height = 0;
+        buffer->uv_scale[0] = 0;
+        buffer->uv_scale[1] = 0;
+        return;
+    }
+
+    buffer->render_width = MIN((i32) ceil(buffer->window_width * buffer->scale), buffer->buffers.width);
+    buffer->render_height = MIN((i32) ceil(buffer->window_height * buffer->scale), buffer->buffers.height);
+    buffer->render_width = MAX(buffer->render_width, 1);
+    buffer->render_height = MAX(buffer->render_height, 1);
+    buffer->uv_scale[0] = (f32) buffer->render_width / (f32) MAX(buffer->buffers.width, 1);
+    buffer->uv_scale[1] = (f32) buffer->render_height / (f32) MAX(buffer->buffers.height, 1);
+}
+
+//Only reallocates when the window grows past the allocated size.
+//Returns false when the reallocation failed (ie. over the gl_memory budget). The buffers are then freed,
+// render_width and render_height are 0 and a later resize can try again.
+bool render_screen_frame_buffers_dynamic_resize(Render_Screen_Frame_Buffers_Dynamic* buffer, i32 window_width, i32 window_height)
+{
+    buffer->window_width = window_width;
+    buffer->window_height = window_height;
+
+    bool state = true;
+    i32 needed_width = (i32) ceil(window_width * buffer->max_scale);
+    i32 needed_height = (i32) ceil(window_height * buffer->max_scale);
+    if(needed_width > buffer->buffers.width || needed_height > buffer->buffers.height)
+        state = render_screen_frame_buffers_init(&buffer->buffers, MAX(needed_width, buffer->buffers.width), MAX(needed_height, buffer->buffers.height));
+
+    if(state == false)
+        LOG_ERROR("RENDER", "render_screen_frame_buffers_dynamic_resize: failed to allocate buffers for window %i x %i", window_width, window_height);
+
+    _render_screen_frame_buffers_dynamic_update_size(buffer);
+    return state;
+}
+
+//min_scale and max_scale are relative to the window size (ie. 0.5 and 1). target_gpu_ms is the GPU time budget of the 
+// whole frame. Leave some headroom since the scale reacts only after a few frames.
+//Returns false and leaves buffer deinitialized when the buffers could not be allocated.
+bool render_screen_frame_buffers_dynamic_init(Render_Screen_Frame_Buffers_Dynamic* buffer, i32 window_width, i32 window_height, f32 min_scale, f32 max_scale, f64 target_gpu_ms)
+{
+    render_screen_frame_buffers_dynamic_deinit(buffer);
+    LOG_INFO("RENDER", "render_screen_frame_buffers_dynamic_init %-4d x %-4d scale: [%.2f, %.2f] target: %.2lfms", window_width, window_height, min_scale, max_scale, target_gpu_ms);
+
+    buffer->min_scale = MAX(min_scale, 0.05f);
+    buffer->max_scale = MAX(max_scale, buffer->min_scale);
+    buffer->scale = buffer->max_scale;
+    buffer->target_gpu_ms = target_gpu_ms;
+    glGenQueries(RENDER_DYNAMIC_RESOLUTION_QUERIES, buffer->queries);
+
+    if(render_screen_frame_buffers_dynamic_resize(buffer, window_width, window_height) == false)
+    {
+        render_screen_frame_buffers_dynamic_deinit(buffer);
+        return false;
+    }
+    return true;
+}
+
+INTERNAL void _render_screen_frame_buffers_dynamic_measured(Render_Screen_Frame_Buffers_Dynamic* buffer, GLuint64 elapsed_ns)
+{
+    f64 gpu_ms = (f64) elapsed_ns / 1e6;
+    f64 scale = buffer->query_scales[buffer->frames_measured % RENDER_DYNAMIC_RESOLUTION_QUERIES];
+    f64 unit_gpu_ms = gpu_ms / (scale*scale);
+    if(buffer->frames_measured == 0)
+    {
+        buffer->smoothed_gpu_ms = gpu_ms;
+        buffer->smoothed_unit_gpu_ms = unit_gpu_ms;
+    }
+    else
+    {
+        buffer->smoothed_gpu_ms += (gpu_ms - buffer->smoothed_gpu_ms) * 0.3;
+        buffer->smoothed_unit_gpu_ms += (unit_gpu_ms - buffer->smoothed_unit_gpu_ms) * 0.3;
+    }
+    buffer->frames_measured += 1;
+}
+
+//Collects finished timer queries without waiting and updates the scale for the next frame.
+INTERNAL void _render_screen_frame_buffers_dynamic_control(Render_Screen_Frame_Buffers_Dynamic* buffer)
+{
+    while(buffer->frames_measured < buffer->frames_begun)
+    {
+        GLuint query = buffer->queries[buffer->frames_measured % RENDER_DYNAMIC_RESOLUTION_QUERIES];
+        GLint available = 0;
+        glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if(available == false)
+            break;
+
+        GLuint64 elapsed_ns = 0;
+        glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed_ns);
+        _render_screen_frame_buffers_dynamic_measured(buffer, elapsed_ns);
+    }
+
+    //Waiting on a query from RENDER_DYNAMIC_RESOLUTION_QUERIES frames back would stall, so 
+    // the oldest one is read blocking only if the ring wrapped around (which means the GPU is way behind).
+    if(buffer->frames_begun - buffer->frames_measured >= RENDER_DYNAMIC_RESOLUTION_QUERIES)
+    {
+        GLuint64 elapsed_ns = 0;
+        glGetQueryObjectui64v(buffer->queries[buffer->frames_measured % RENDER_DYNAMIC_RESOLUTION_QUERIES], GL_QUERY_RESULT, &elapsed_ns);
+        _render_screen_frame_buffers_dynamic_measured(buffer, elapsed_ns);
+    }
+
+    if(buffer->frames_measured > 0 && buffer->smoothed_unit_gpu_ms > 0 && buffer->target_gpu_ms > 0)
+    {
+        //GPU time is roughly proportional to the pixel count which goes with scale^2. The measurements are
+        // a few frames old and were taken at the scale of their frame, not the current one, so the desired scale 
+        // is derived from the time normalized by that scale (ie. measured_scale * sqrt(target / measured_ms)).
+        //React fast when over budget and slowly when under to avoid oscillation.
+        f64 desired = sqrt(buffer->target_gpu_ms / buffer->smoothed_unit_gpu_ms);
+        f64 rate = desired < buffer->scale ? 0.5 : 0.1;
+        f64 scale = buffer->scale + (desired - buffer->scale) * rate;
+        buffer->scale = (f32) MAX(MIN(scale, buffer->max_scale), buffer->min_scale);
+    }
+
+    _render_screen_frame_buffers_dynamic_update_size(buffer);
+}
+
+void render_screen_frame_buffers_dynamic_render_begin(Render_Screen_Frame_Buffers_Dynamic* buffer)
+{
+    _render_screen_frame_buffers_dynamic_control(buffer);
+
+    render_screen_frame_buffers_render_begin(&buffer->buffers);
+    glViewport(0, 0, buffer->render_width, buffer->render_height);
+    buffer->query_scales[buffer->frames_begun % RENDER_DYNAMIC_RESOLUTION_QUERIES] = buffer->scale;
+    glBeginQuery(GL_TIME_ELAPSED, buffer->queries[buffer->frames_begun % RENDER_DYNAMIC_RESOLUTION_QUERIES]);
+}
+
+void render_screen_frame_buffers_dynamic_render_end(Render_Screen_Frame_Buffers_Dynamic* buffer)
+{
+    glEndQuery(GL_TIME_ELAPSED);
+    buffer->frames_begun += 1;
+    render_screen_frame_buffers_render_end(&buffer->buffers);
+}
+
+//Binds the default framebuffer with the full window viewport. Sample buffers.screen_color_buff with uvs multiplied by uv_scale.
+void render_screen_frame_buffers_dynamic_post_process_begin(Render_Screen_Frame_Buffers_Dynamic* buffer)
+{
+    render_screen_frame_buffers_post_process_begin(&buffer->buffers);
+    glViewport(0, 0, buffer->window_width, buffer->window_height);
+}
+
+void render_screen_frame_buffers_dynamic_post_process_end(Render_Screen_Frame_Buffers_Dynamic* buffer)
+{
+    render_screen_frame_buffers_post_process_end(&buffer->buffers);
+}
+
+//Simplest possible upscale: bilinear blit of the rendered part to the whole default framebuffer.
+void render_screen_frame_buffers_dynamic_upscale_to_screen(Render_Screen_Frame_Buffers_Dynamic* buffer)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, buffer->buffers.frame_buff);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, buffer->render_width, buffer->render_height, 0, 0, buffer->window_width, buffer->window_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
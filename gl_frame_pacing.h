@@ -0,0 +1,229 @@
+#pragma once
+
+//Bounds how far the CPU can run ahead of the GPU. Every frame ends with a fence and the beginning of a frame
+// waits on the fence of the frame max_frames_in_flight frames ago. Without this the driver happily queues
+// several frames which shows up as input to display latency without any other signal.
+//
+//Usage:
+//    i64 frame = gl_frame_pacer_frame_begin(&pacer);
+//    gl_buffer_pool_frame_begin(&pool, frame);   //anything per frame can key off the same frame index
+//    ... render ...
+//    gl_frame_pacer_frame_end(&pacer);
+//    swap buffers
+//
+//Streaming rings (uploads, readbacks) can reuse the per frame fences instead of making their own:
+// remember the frame index a region was last used in and check gl_frame_pacer_is_complete before reusing it.
+//A ring with at least max_frames_in_flight regions indexed by frame never has to wait at all
+// (ie. GL_Buffer_Pool with transient_frame_count >= max_frames_in_flight).
+//
+//GPU latency is the time from the fence being inserted until it is seen signaled. Fences are only looked at
+// from within this module (frame_begin, is_complete, wait_for) so it is an upper bound with the resolution
+// of how often those are called - in practice once per frame.
+
+#include "gl.h"
+#include "../lib/platform.h"
+#include "../lib/log.h"
+
+enum {
+    GL_FRAME_PACER_MAX_FRAMES = 8,
+    GL_FRAME_PACER_HISTORY = 128,
+};
+
+typedef struct GL_Frame_Timing {
+    i64 frame;
+    f64 cpu_wait_ms;      //time frame_begin was blocked waiting for the GPU
+    f64 gpu_latency_ms;   //time from frame_end until the frames fence was seen signaled. Negative while still in flight
+    i32 frames_in_flight; //frames still queued on the GPU when this frame began (before waiting)
+} GL_Frame_Timing;
+
+typedef struct GL_Frame_Pacing_Stats {
+    isize frame_count;    //frames in the history window
+    isize stalled_frames; //frames for which frame_begin had to wait
+    f64 cpu_wait_mean_ms;
+    f64 cpu_wait_max_ms;
+    f64 gpu_latency_mean_ms;
+    f64 gpu_latency_max_ms;
+    f64 frames_in_flight_mean;
+} GL_Frame_Pacing_Stats;
+
+typedef struct GL_Frame_Pacer {
+    GLsync fences[GL_FRAME_PACER_MAX_FRAMES];
+    i64 submit_times[GL_FRAME_PACER_MAX_FRAMES];
+
+    i64 frame;            //the frame currently being recorded
+    i64 completed_frame;  //all frames up to and including this one are done on the GPU
+    i32 max_frames_in_flight;
+    bool in_frame;
+
+    GL_Frame_Timing history[GL_FRAME_PACER_HISTORY];
+} GL_Frame_Pacer;
+
+void gl_frame_pacer_deinit(GL_Frame_Pacer* pacer)
+{
+    for(isize i = 0; i < GL_FRAME_PACER_MAX_FRAMES; i++)
+        if(pacer->fences[i])
+            glDeleteSync(pacer->fences[i]);
+
+    memset(pacer, 0, sizeof *pacer);
+}
+
+//max_frames_in_flight of 1 fully serializes CPU and GPU, 2 is the usual double buffering.
+//Clamped to [1, GL_FRAME_PACER_MAX_FRAMES].
+void gl_frame_pacer_init(GL_Frame_Pacer* pacer, i32 max_frames_in_flight)
+{
+    gl_frame_pacer_deinit(pacer);
+    pacer->max_frames_in_flight = MAX(MIN(max_frames_in_flight, GL_FRAME_PACER_MAX_FRAMES), 1);
+    pacer->completed_frame = -1;
+    for(isize i = 0; i < GL_FRAME_PACER_HISTORY; i++)
+        pacer->history[i].frame = -1;
+}
+
+INTERNAL f64 _gl_frame_pacer_ms(i64 ticks)
+{
+    return (f64) ticks * 1000.0 / (f64) platform_perf_counter_frequency();
+}
+
+INTERNAL void _gl_frame_pacer_retire(GL_Frame_Pacer* pacer, i64 frame, i64 now)
+{
+    isize slot = (isize) (frame % GL_FRAME_PACER_MAX_FRAMES);
+    glDeleteSync(pacer->fences[slot]);
+    pacer->fences[slot] = 0;
+    pacer->completed_frame = frame;
+
+    GL_Frame_Timing* timing = &pacer->history[frame % GL_FRAME_PACER_HISTORY];
+    if(timing->frame == frame)
+        timing->gpu_latency_ms = _gl_frame_pacer_ms(now - pacer->submit_times[slot]);
+}
+
+//Checks the oldest frames in order and retires every one that has finished.
+//If wait_until_frame is >= 0 blocks until that frame (and so all before it) has finished.
+INTERNAL void _gl_frame_pacer_update(GL_Frame_Pacer* pacer, i64 wait_until_frame)
+{
+    //Only frames that were ended have a fence
+    i64 last_submitted = pacer->frame - 1;
+    wait_until_frame = MIN(wait_until_frame, last_submitted);
+
+    for(i64 frame = pacer->completed_frame + 1; frame <= last_submitted; frame++)
+    {
+        GLsync fence = pacer->fences[frame % GL_FRAME_PACER_MAX_FRAMES];
+        bool wait = frame <= wait_until_frame;
+        GLenum status = GL_TIMEOUT_EXPIRED;
+        do {
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0);
+        } while(wait && status == GL_TIMEOUT_EXPIRED);
+
+        if(status == GL_TIMEOUT_EXPIRED)
+            break;
+
+        if(status == GL_WAIT_FAILED)
+            LOG_ERROR("RENDER", "gl_frame_pacer: glClientWaitSync failed for frame %lli", (long long) frame);
+
+        _gl_frame_pacer_retire(pacer, frame, platform_perf_counter());
+    }
+}
+
+//Returns true if the GPU has finished all commands up to the end of the given frame. Never blocks.
+bool gl_frame_pacer_is_complete(GL_Frame_Pacer* pacer, i64 frame)
+{
+    if(frame > pacer->completed_frame)
+        _gl_frame_pacer_update(pacer, -1);
+    return frame <= pacer->completed_frame;
+}
+
+//Blocks until the GPU has finished the given frame. Frames that were not yet ended cannot be waited on
+// and return false.
+bool gl_frame_pacer_wait_for(GL_Frame_Pacer* pacer, i64 frame)
+{
+    if(frame > pacer->completed_frame)
+        _gl_frame_pacer_update(pacer, frame);
+    return frame <= pacer->completed_frame;
+}
+
+//Waits until at most max_frames_in_flight - 1 frames are queued on the GPU so that together with
+// the frame about to be recorded there are at most max_frames_in_flight. Returns the index of the new frame.
+i64 gl_frame_pacer_frame_begin(GL_Frame_Pacer* pacer)
+{
+    ASSERT(pacer->max_frames_in_flight > 0 && "must be initialized");
+    ASSERT(pacer->in_frame == false);
+
+    _gl_frame_pacer_update(pacer, -1);
+    i32 in_flight = (i32) (pacer->frame - 1 - pacer->completed_frame);
+
+    i64 before = platform_perf_counter();
+    gl_frame_pacer_wait_for(pacer, pacer->frame - pacer->max_frames_in_flight);
+    i64 after = platform_perf_counter();
+
+    GL_Frame_Timing* timing = &pacer->history[pacer->frame % GL_FRAME_PACER_HISTORY];
+    timing->frame = pacer->frame;
+    timing->cpu_wait_ms = _gl_frame_pacer_ms(after - before);
+    timing->gpu_latency_ms = -1;
+    timing->frames_in_flight = in_flight;
+
+    pacer->in_frame = true;
+    return pacer->frame;
+}
+
+void gl_frame_pacer_frame_end(GL_Frame_Pacer* pacer)
+{
+    ASSERT(pacer->in_frame);
+    isize slot = (isize) (pacer->frame % GL_FRAME_PACER_MAX_FRAMES);
+    ASSERT(pacer->fences[slot] == 0);
+
+    pacer->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pacer->submit_times[slot] = platform_perf_counter();
+    pacer->frame += 1;
+    pacer->in_frame = false;
+}
+
+//Timing of a recent frame or NULL if it is no longer (or not yet) in the history
+const GL_Frame_Timing* gl_frame_pacer_timing(const GL_Frame_Pacer* pacer, i64 frame)
+{
+    if(frame < 0)
+        return NULL;
+
+    const GL_Frame_Timing* timing = &pacer->history[frame % GL_FRAME_PACER_HISTORY];
+    return timing->frame == frame ? timing : NULL;
+}
+
+//Aggregates the last GL_FRAME_PACER_HISTORY frames. GPU latency only includes frames that have completed.
+GL_Frame_Pacing_Stats gl_frame_pacer_stats(const GL_Frame_Pacer* pacer)
+{
+    GL_Frame_Pacing_Stats stats = {0};
+    isize latency_count = 0;
+    for(isize i = 0; i < GL_FRAME_PACER_HISTORY; i++)
+    {
+        const GL_Frame_Timing* timing = &pacer->history[i];
+        if(timing->frame < 0)
+            continue;
+
+        stats.frame_count += 1;
+        stats.stalled_frames += timing->cpu_wait_ms > 0.01;
+        stats.cpu_wait_mean_ms += timing->cpu_wait_ms;
+        stats.cpu_wait_max_ms = MAX(stats.cpu_wait_max_ms, timing->cpu_wait_ms);
+        stats.frames_in_flight_mean += timing->frames_in_flight;
+        if(timing->gpu_latency_ms >= 0)
+        {
+            latency_count += 1;
+            stats.gpu_latency_mean_ms += timing->gpu_latency_ms;
+            stats.gpu_latency_max_ms = MAX(stats.gpu_latency_max_ms, timing->gpu_latency_ms);
+        }
+    }
+
+    if(stats.frame_count > 0)
+    {
+        stats.cpu_wait_mean_ms /= (f64) stats.frame_count;
+        stats.frames_in_flight_mean /= (f64) stats.frame_count;
+    }
+    if(latency_count > 0)
+        stats.gpu_latency_mean_ms /= (f64) latency_count;
+
+    return stats;
+}
+
+void gl_frame_pacer_log_stats(const GL_Frame_Pacer* pacer)
+{
+    GL_Frame_Pacing_Stats stats = gl_frame_pacer_stats(pacer);
+    LOG_INFO("RENDER", "frame pacing over %lli frames: cpu wait %.3lf ms (max %.3lf) stalled %lli, gpu latency %.3lf ms (max %.3lf), in flight %.2lf / %i",
+        (long long) stats.frame_count, stats.cpu_wait_mean_ms, stats.cpu_wait_max_ms, (long long) stats.stalled_frames,
+        stats.gpu_latency_mean_ms, stats.gpu_latency_max_ms, stats.frames_in_flight_mean, pacer->max_frames_in_flight);
+}
@@ -0,0 +1,441 @@
+#pragma once
+
+//Data parallel building blocks running as compute shaders: multi pass reduction (sum, min, max), exclusive
+// prefix scan and histogram. Meant for things like tone mapping and validation where we would otherwise
+// read entire float framebuffers back just to compute a handful of numbers.
+//
+//The kernels live in shaders/gpu_*.comp and are compiled in several variants through
+// compute_shader_init_from_disk_with_defines. The final results of reductions and histograms are written
+// into a small results buffer owned by Gpu_Primitives so only that needs to go back to the CPU, which is done
+// asynchronously with Gpu_Readback (a copy into a staging buffer followed by a fence).
+//
+//All inputs are tightly packed floats. Texture inputs are sampled with sampler2D so integer formats are not supported.
+//Inputs needing more workgroups than GL_MAX_COMPUTE_WORK_GROUP_COUNT allows are split into several dispatches
+// by compute_shader_dispatch. Counts are limited to INT32_MAX elements.
+
+#include "gl.h"
+#include "gl_shader_util.h"
+#include "gl_memory.h"
+#include "../lib/log.h"
+
+typedef enum {
+    GPU_REDUCE_SUM,
+    GPU_REDUCE_MIN,
+    GPU_REDUCE_MAX,
+    GPU_REDUCE_OP_COUNT,
+} Gpu_Reduce_Op;
+
+enum {
+    GPU_PRIMITIVES_ITEMS_PER_THREAD = 4,
+    GPU_PRIMITIVES_MAX_BLOCK_SIZE = 256,
+    GPU_SCAN_MAX_LEVELS = 8,
+};
+
+typedef struct Gpu_Scratch_Buffer {
+    GLuint handle;
+    isize capacity; //in bytes
+} Gpu_Scratch_Buffer;
+
+typedef struct Gpu_Primitives {
+    GL_Shader reduce[GPU_REDUCE_OP_COUNT];
+    GL_Shader reduce_texture[GPU_REDUCE_OP_COUNT];
+    GL_Shader scan_blocks;
+    GL_Shader scan_add_offsets;
+    GL_Shader histogram;
+    GL_Shader histogram_texture;
+
+    Gpu_Scratch_Buffer reduce_scratch[2];
+    Gpu_Scratch_Buffer scan_sums[GPU_SCAN_MAX_LEVELS];
+    Gpu_Scratch_Buffer scan_sums_scanned[GPU_SCAN_MAX_LEVELS];
+
+    //Small buffer the final results are written into. Indexed in 4 byte elements.
+    GLuint results;
+    isize result_count;
+
+    isize block_size;
+    isize bin_count;
+} Gpu_Primitives;
+
+typedef struct Gpu_Readback {
+    GLuint buffer;
+    GLsync fence;
+    isize capacity;
+    isize size;
+} Gpu_Readback;
+
+INTERNAL const char* _gpu_reduce_op_define(Gpu_Reduce_Op op)
+{
+    switch(op)
+    {
+        case GPU_REDUCE_MIN: return "OP_MIN";
+        case GPU_REDUCE_MAX: return "OP_MAX";
+        default:             return "OP_SUM";
+    }
+}
+
+INTERNAL void _gpu_scratch_buffer_reserve(Gpu_Scratch_Buffer* buffer, isize size)
+{
+    if(buffer->handle != 0 && buffer->capacity >= size)
+        return;
+
+    isize capacity = MAX(size, buffer->capacity*2);
+    gl_memory_untrack(GL_MEMORY_BUFFER, buffer->handle);
+    glDeleteBuffers(1, &buffer->handle);
+    glGenBuffers(1, &buffer->handle);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer->handle);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) capacity, NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    buffer->capacity = capacity;
+    gl_memory_track(GL_MEMORY_BUFFER, buffer->handle, capacity, "Gpu_Primitives");
+}
+
+INTERNAL void _gpu_scratch_buffer_deinit(Gpu_Scratch_Buffer* buffer)
+{
+    gl_memory_untrack(GL_MEMORY_BUFFER, buffer->handle);
+    glDeleteBuffers(1, &buffer->handle);
+    memset(buffer, 0, sizeof *buffer);
+}
+
+INTERNAL void _gpu_shader_deinit(GL_Shader* shader)
+{
+    if(shader->handle != 0)
+    {
+        render_shader_unuse(shader);
+        glDeleteProgram(shader->handle);
+    }
+    memset(shader, 0, sizeof *shader);
+}
+
+void gpu_primitives_deinit(Gpu_Primitives* prims)
+{
+    for(isize i = 0; i < GPU_REDUCE_OP_COUNT; i++)
+    {
+        _gpu_shader_deinit(&prims->reduce[i]);
+        _gpu_shader_deinit(&prims->reduce_texture[i]);
+    }
+    _gpu_shader_deinit(&prims->scan_blocks);
+    _gpu_shader_deinit(&prims->scan_add_offsets);
+    _gpu_shader_deinit(&prims->histogram);
+    _gpu_shader_deinit(&prims->histogram_texture);
+
+    for(isize i = 0; i < 2; i++)
+        _gpu_scratch_buffer_deinit(&prims->reduce_scratch[i]);
+    for(isize i = 0; i < GPU_SCAN_MAX_LEVELS; i++)
+    {
+        _gpu_scratch_buffer_deinit(&prims->scan_sums[i]);
+        _gpu_scratch_buffer_deinit(&prims->scan_sums_scanned[i]);
+    }
+
+    gl_memory_untrack(GL_MEMORY_BUFFER, prims->results);
+    glDeleteBuffers(1, &prims->results);
+    memset(prims, 0, sizeof *prims);
+}
+
+INTERNAL bool _gpu_primitives_compile(Shader_File_Cache* cache, GL_Shader* shader, String kernel_directory, const char* file, isize block_size, const char* defines)
+{
+    bool state = false;
+    SCRATCH_ARENA(arena)
+    {
+        String path = format(arena.alloc, "%.*s/%s", STRING_PRINT(kernel_directory), file);
+        String all_defines = format(arena.alloc, "#define ITEMS_PER_THREAD %i\n%s", (int) GPU_PRIMITIVES_ITEMS_PER_THREAD, defines);
+        compute_shader_init_from_disk_with_defines(cache, shader, path, block_size, 1, 1, all_defines);
+        state = shader->handle != 0;
+    }
+    return state;
+}
+
+//Compiles all kernels found in kernel_directory (the shaders/ directory of this library).
+//bin_count is the number of bins of gpu_histogram and result_count the size of the results buffer in 4 byte elements.
+bool gpu_primitives_init(Gpu_Primitives* prims, Shader_File_Cache* cache, String kernel_directory, isize bin_count, isize result_count)
+{
+    gpu_primitives_deinit(prims);
+
+    //The largest power of two block size that is allowed. The reduction and scan kernels need a power of two.
+    Compute_Shader_Limits limits = compute_shader_query_limits();
+    isize max_block_size = MIN(MIN(limits.max_group_size[0], limits.max_group_invocations), GPU_PRIMITIVES_MAX_BLOCK_SIZE);
+    prims->block_size = 1;
+    while(prims->block_size*2 <= max_block_size)
+        prims->block_size *= 2;
+
+    prims->bin_count = MAX(bin_count, 1);
+    prims->result_count = MAX(result_count, prims->bin_count);
+    LOG_INFO("RENDER", "gpu_primitives_init block size: %lli bins: %lli results: %lli", (long long) prims->block_size, (long long) prims->bin_count, (long long) prims->result_count);
+
+    bool state = true;
+    SCRATCH_ARENA(arena)
+    {
+        for(isize i = 0; i < GPU_REDUCE_OP_COUNT; i++)
+        {
+            const char* op = _gpu_reduce_op_define((Gpu_Reduce_Op) i);
+            String buffer_defines = format(arena.alloc, "#define %s\n", op);
+            String texture_defines = format(arena.alloc, "#define %s\n#define INPUT_TEXTURE\n", op);
+            state = state && _gpu_primitives_compile(cache, &prims->reduce[i], kernel_directory, "gpu_reduce.comp", prims->block_size, buffer_defines.data);
+            state = state && _gpu_primitives_compile(cache, &prims->reduce_texture[i], kernel_directory, "gpu_reduce.comp", prims->block_size, texture_defines.data);
+        }
+
+        String bins = format(arena.alloc, "#define BIN_COUNT %lli\n", (long long) prims->bin_count);
+        String bins_texture = format(arena.alloc, "#define BIN_COUNT %lli\n#define INPUT_TEXTURE\n", (long long) prims->bin_count);
+        state = state && _gpu_primitives_compile(cache, &prims->scan_blocks, kernel_directory, "gpu_scan.comp", prims->block_size, "#define SCAN_BLOCKS\n");
+        state = state && _gpu_primitives_compile(cache, &prims->scan_add_offsets, kernel_directory, "gpu_scan.comp", prims->block_size, "#define ADD_OFFSETS\n");
+        state = state && _gpu_primitives_compile(cache, &prims->histogram, kernel_directory, "gpu_histogram.comp", prims->block_size, bins.data);
+        state = state && _gpu_primitives_compile(cache, &prims->histogram_texture, kernel_directory, "gpu_histogram.comp", prims->block_size, bins_texture.data);
+    }
+
+    if(state == false)
+    {
+        LOG_ERROR("RENDER", "gpu_primitives_init: compilation of kernels in '%.*s' failed", STRING_PRINT(kernel_directory));
+        return false;
+    }
+
+    if(gl_memory_check_budget(prims->result_count*4, "Gpu_Primitives") == false)
+        return false;
+
+    glGenBuffers(1, &prims->results);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, prims->results);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, (GLsizeiptr) (prims->result_count*4), NULL, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    gl_memory_track(GL_MEMORY_BUFFER, prims->results, prims->result_count*4, "Gpu_Primitives");
+    return true;
+}
+
+//The kernels index with 32 bit integers
+INTERNAL bool _gpu_primitives_check_count(const char* name, isize count)
+{
+    if(count > INT32_MAX)
+    {
+        LOG_ERROR("RENDER", "%s: input of %lli elements is more than the maximum of %lli", name, (long long) count, (long long) INT32_MAX);
+        return false;
+    }
+    return true;
+}
+
+INTERNAL bool _gpu_reduce(Gpu_Primitives* prims, Gpu_Reduce_Op op, GLuint input_buffer, GLuint input_texture, i32 channel, isize count, isize result_index)
+{
+    ASSERT(0 <= op && op < GPU_REDUCE_OP_COUNT);
+    ASSERT(0 <= result_index && result_index < prims->result_count);
+    isize per_group = prims->block_size*GPU_PRIMITIVES_ITEMS_PER_THREAD;
+    isize first_group_count = DIV_CEIL(MAX(count, 1), per_group);
+    if(_gpu_primitives_check_count("gpu_reduce", count) == false)
+        return false;
+
+    for(isize i = 0; i < 2; i++)
+        _gpu_scratch_buffer_reserve(&prims->reduce_scratch[i], first_group_count*(isize) sizeof(f32));
+
+    //Every pass shrinks the input by per_group until a single value remains which goes into the results buffer
+    GL_Shader* shader = input_texture != 0 ? &prims->reduce_texture[op] : &prims->reduce[op];
+    GLuint from = input_buffer;
+    for(isize pass = 0; ; pass++)
+    {
+        isize group_count = DIV_CEIL(MAX(count, 1), per_group);
+        bool is_last = group_count == 1;
+        GLuint to = is_last ? prims->results : prims->reduce_scratch[pass % 2].handle;
+
+        if(pass == 0 && input_texture != 0)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, input_texture);
+            render_shader_set_i32(shader, "u_input", 0);
+            render_shader_set_i32(shader, "u_channel", channel);
+        }
+        else
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, from);
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, to);
+        render_shader_set_i32(shader, "u_count", (i32) count);
+        render_shader_set_i32(shader, "u_output_offset", is_last ? (i32) result_index : 0);
+        if(compute_shader_dispatch(shader, group_count*prims->block_size, 1, 1) == false)
+            return false;
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        if(is_last)
+            break;
+
+        from = to;
+        count = group_count;
+        shader = &prims->reduce[op];
+    }
+
+    return true;
+}
+
+//Reduces count floats of input_buffer into a single float at results[result_index]
+bool gpu_reduce(Gpu_Primitives* prims, Gpu_Reduce_Op op, GLuint input_buffer, isize count, isize result_index)
+{
+    return _gpu_reduce(prims, op, input_buffer, 0, 0, count, result_index);
+}
+
+//Reduces the given channel of the first count texels (in row major order) of mip 0 of a GL_TEXTURE_2D.
+//Uses texture unit 0.
+bool gpu_reduce_texture(Gpu_Primitives* prims, Gpu_Reduce_Op op, GLuint texture, i32 channel, isize count, isize result_index)
+{
+    ASSERT(texture != 0 && 0 <= channel && channel < 4);
+    return _gpu_reduce(prims, op, 0, texture, channel, count, result_index);
+}
+
+INTERNAL bool _gpu_scan_level(Gpu_Primitives* prims, GLuint input_buffer, GLuint output_buffer, isize count, isize level)
+{
+    ASSERT(level < GPU_SCAN_MAX_LEVELS);
+    isize group_count = DIV_CEIL(MAX(count, 1), prims->block_size);
+    Gpu_Scratch_Buffer* sums = &prims->scan_sums[level];
+    Gpu_Scratch_Buffer* sums_scanned = &prims->scan_sums_scanned[level];
+    _gpu_scratch_buffer_reserve(sums, group_count*(isize) sizeof(f32));
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, input_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, output_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sums->handle);
+    render_shader_set_i32(&prims->scan_blocks, "u_count", (i32) count);
+    if(compute_shader_dispatch(&prims->scan_blocks, group_count*prims->block_size, 1, 1) == false)
+        return false;
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+    //Scan the per block totals and add them back. Each level divides the size by block_size
+    // so GPU_SCAN_MAX_LEVELS is plenty even for the smallest allowed block size.
+    if(group_count > 1)
+    {
+        _gpu_scratch_buffer_reserve(sums_scanned, group_count*(isize) sizeof(f32));
+        if(_gpu_scan_level(prims, sums->handle, sums_scanned->handle, group_count, level + 1) == false)
+            return false;
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, output_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sums_scanned->handle);
+        render_shader_set_i32(&prims->scan_add_offsets, "u_count", (i32) count);
+        if(compute_shader_dispatch(&prims->scan_add_offsets, group_count*prims->block_size, 1, 1) == false)
+            return false;
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    return true;
+}
+
+//Exclusive prefix sum of count floats of input_buffer into output_buffer. The two may not be the same buffer.
+//The output stays on the GPU.
+bool gpu_scan(Gpu_Primitives* prims, GLuint input_buffer, GLuint output_buffer, isize count)
+{
+    ASSERT(input_buffer != output_buffer);
+    if(_gpu_primitives_check_count("gpu_scan", count) == false)
+        return false;
+
+    return _gpu_scan_level(prims, input_buffer, output_buffer, count, 0);
+}
+
+INTERNAL bool _gpu_histogram(Gpu_Primitives* prims, GLuint input_buffer, GLuint input_texture, i32 channel, isize count, f32 min, f32 max, isize result_index)
+{
+    ASSERT(0 <= result_index && result_index + prims->bin_count <= prims->result_count);
+    isize group_count = DIV_CEIL(MAX(count, 1), prims->block_size*GPU_PRIMITIVES_ITEMS_PER_THREAD);
+    if(_gpu_primitives_check_count("gpu_histogram", count) == false)
+        return false;
+
+    GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, prims->results);
+    glClearBufferSubData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, (GLintptr) (result_index*4), (GLsizeiptr) (prims->bin_count*4), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    GL_Shader* shader = &prims->histogram;
+    if(input_texture != 0)
+    {
+        shader = &prims->histogram_texture;
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, input_texture);
+        render_shader_set_i32(shader, "u_input", 0);
+        render_shader_set_i32(shader, "u_channel", channel);
+    }
+    else
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, input_buffer);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, prims->results);
+    render_shader_set_i32(shader, "u_count", (i32) count);
+    render_shader_set_i32(shader, "u_output_offset", (i32) result_index);
+    render_shader_set_f32(shader, "u_min", min);
+    render_shader_set_f32(shader, "u_max", max);
+    bool state = compute_shader_dispatch(shader, group_count*prims->block_size, 1, 1);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    return state;
+}
+
+//Counts count floats of input_buffer into bin_count uint bins spanning [min, max] written to results[result_index...].
+//Values outside of the range land in the first/last bin.
+bool gpu_histogram(Gpu_Primitives* prims, GLuint input_buffer, isize count, f32 min, f32 max, isize result_index)
+{
+    return _gpu_histogram(prims, input_buffer, 0, 0, count, min, max, result_index);
+}
+
+bool gpu_histogram_texture(Gpu_Primitives* prims, GLuint texture, i32 channel, isize count, f32 min, f32 max, isize result_index)
+{
+    ASSERT(texture != 0 && 0 <= channel && channel < 4);
+    return _gpu_histogram(prims, 0, texture, channel, count, min, max, result_index);
+}
+
+void gpu_readback_deinit(Gpu_Readback* readback)
+{
+    if(readback->fence)
+        glDeleteSync(readback->fence);
+    gl_memory_untrack(GL_MEMORY_BUFFER, readback->buffer);
+    glDeleteBuffers(1, &readback->buffer);
+    memset(readback, 0, sizeof *readback);
+}
+
+//Copies size bytes from from_buffer at offset into a staging buffer and inserts a fence after it.
+//The data can be retrieved later with gpu_readback_poll without stalling the pipeline.
+//Starting a new readback discards the pending one.
+void gpu_readback_begin(Gpu_Readback* readback, GLuint from_buffer, isize offset, isize size)
+{
+    if(readback->fence)
+        glDeleteSync(readback->fence);
+
+    if(readback->buffer == 0 || readback->capacity < size)
+    {
+        gl_memory_untrack(GL_MEMORY_BUFFER, readback->buffer);
+        glDeleteBuffers(1, &readback->buffer);
+        glGenBuffers(1, &readback->buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, readback->buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) size, NULL, GL_STREAM_READ);
+        readback->capacity = size;
+        gl_memory_track(GL_MEMORY_BUFFER, readback->buffer, size, "Gpu_Readback");
+    }
+
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_COPY_READ_BUFFER, from_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, readback->buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr) offset, 0, (GLsizeiptr) size);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    readback->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback->size = size;
+}
+
+//Starts a readback of count 4 byte elements of the results buffer
+void gpu_primitives_readback_begin(Gpu_Primitives* prims, Gpu_Readback* readback, isize result_index, isize count)
+{
+    ASSERT(0 <= result_index && result_index + count <= prims->result_count);
+    gpu_readback_begin(readback, prims->results, result_index*4, count*4);
+}
+
+//Returns true and fills into (readback->size bytes) once the copy has finished.
+//If wait is true blocks until then, otherwise returns false immediately when the GPU is not done yet.
+bool gpu_readback_poll(Gpu_Readback* readback, void* into, bool wait)
+{
+    if(readback->fence == 0)
+        return false;
+
+    GLuint64 timeout = wait ? 1000000000 : 0;
+    GLenum status = GL_TIMEOUT_EXPIRED;
+    do {
+        status = glClientWaitSync(readback->fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+    } while(wait && status == GL_TIMEOUT_EXPIRED);
+
+    if(status == GL_TIMEOUT_EXPIRED)
+        return false;
+
+    glDeleteSync(readback->fence);
+    readback->fence = 0;
+    if(status == GL_WAIT_FAILED)
+    {
+        LOG_ERROR("RENDER", "gpu_readback_poll: glClientWaitSync failed");
+        return false;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, readback->buffer);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, 0, (GLsizeiptr) readback->size, into);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    return true;
+}
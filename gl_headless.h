@@ -0,0 +1,246 @@
+#pragma once
+
+//Headless OpenGL contexts through EGL. Prefers the Mesa surfaceless platform so that it runs without any
+// display or GPU (llvmpipe) and falls back to the default display with a tiny pbuffer surface.
+//Link with -lEGL.
+//Every context carries its own GL_Context_State which is bound on the thread that makes it current. The state is
+// heap allocated so that the GL_Headless_Context struct itself can be freely moved or copied around.
+//The EGL display is initialized by the first context that uses it and terminated by the last one to be deinited.
+
+#include "gl.h"
+#include "gl_context_state.h"
+#include "../lib/platform.h"
+#include "../lib/log.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdlib.h>
+
+typedef struct GL_Headless_Context {
+    EGLDisplay display;
+    EGLContext context;
+    EGLSurface surface; //EGL_NO_SURFACE when surfaceless
+    EGLConfig  config;
+
+    i32 gl_version; //as returned from glad ie. GLAD_MAKE_VERSION(major, minor)
+    bool has_display_ref;
+    GL_Context_State* state; //owned. Stays at the same address for the whole lifetime of the context
+} GL_Headless_Context;
+
+INTERNAL bool _gl_headless_has_extension(const char* extensions, const char* name)
+{
+    if(extensions == NULL)
+        return false;
+
+    size_t name_len = strlen(name);
+    for(const char* at = strstr(extensions, name); at != NULL; at = strstr(at + name_len, name))
+    {
+        bool starts = at == extensions || at[-1] == ' ';
+        bool ends = at[name_len] == ' ' || at[name_len] == '\0';
+        if(starts && ends)
+            return true;
+    }
+
+    return false;
+}
+
+//eglInitialize is not reference counted - calling it again does nothing and a single eglTerminate ends the display 
+// for everyone. Since independent contexts (ie. the gl_batch threads) get the same display the references are counted here.
+typedef struct _GL_Headless_Display_Ref {
+    EGLDisplay display;
+    i32 refs;
+} _GL_Headless_Display_Ref;
+
+enum {_GL_HEADLESS_MAX_DISPLAYS = 8};
+static _GL_Headless_Display_Ref _gl_headless_displays[_GL_HEADLESS_MAX_DISPLAYS] = {0};
+static volatile i32 _gl_headless_displays_lock = 0;
+
+INTERNAL void _gl_headless_displays_lock_acquire()
+{
+    while(platform_atomic_add32(&_gl_headless_displays_lock, 1) != 0)
+    {
+        platform_atomic_add32(&_gl_headless_displays_lock, -1);
+        platform_thread_yield();
+    }
+}
+
+INTERNAL void _gl_headless_displays_lock_release()
+{
+    platform_atomic_add32(&_gl_headless_displays_lock, -1);
+}
+
+//Initializes display if it is not yet used by any context and takes a reference to it
+INTERNAL bool _gl_headless_display_acquire(EGLDisplay display)
+{
+    bool state = false;
+    _gl_headless_displays_lock_acquire();
+    _GL_Headless_Display_Ref* ref = NULL;
+    for(isize i = 0; i < _GL_HEADLESS_MAX_DISPLAYS && ref == NULL; i++)
+        if(_gl_headless_displays[i].display == display)
+            ref = &_gl_headless_displays[i];
+
+    for(isize i = 0; i < _GL_HEADLESS_MAX_DISPLAYS && ref == NULL; i++)
+        if(_gl_headless_displays[i].refs == 0)
+            ref = &_gl_headless_displays[i];
+
+    if(ref == NULL)
+        LOG_ERROR("RENDER", "gl_headless_context_init: too many EGL displays in use");
+    else if(ref->refs > 0 || eglInitialize(display, NULL, NULL) == EGL_TRUE)
+    {
+        ref->display = display;
+        ref->refs += 1;
+        state = true;
+    }
+    _gl_headless_displays_lock_release();
+    return state;
+}
+
+INTERNAL void _gl_headless_display_release(EGLDisplay display)
+{
+    _gl_headless_displays_lock_acquire();
+    for(isize i = 0; i < _GL_HEADLESS_MAX_DISPLAYS; i++)
+    {
+        _GL_Headless_Display_Ref* ref = &_gl_headless_displays[i];
+        if(ref->display == display && ref->refs > 0)
+        {
+            ref->refs -= 1;
+            if(ref->refs == 0)
+            {
+                eglTerminate(display);
+                ref->display = EGL_NO_DISPLAY;
+            }
+            break;
+        }
+    }
+    _gl_headless_displays_lock_release();
+}
+
+void gl_headless_context_deinit(GL_Headless_Context* context)
+{
+    if(context->state && gl_context_state_get_bound() == context->state)
+        gl_context_state_bind(NULL);
+    free(context->state);
+
+    if(context->display != EGL_NO_DISPLAY)
+    {
+        eglMakeCurrent(context->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if(context->surface != EGL_NO_SURFACE)
+            eglDestroySurface(context->display, context->surface);
+        if(context->context != EGL_NO_CONTEXT)
+            eglDestroyContext(context->display, context->context);
+        if(context->has_display_ref)
+            _gl_headless_display_release(context->display);
+    }
+
+    memset(context, 0, sizeof *context);
+}
+
+bool gl_headless_context_make_current(GL_Headless_Context* context)
+{
+    if(eglMakeCurrent(context->display, context->surface, context->surface, context->context) != EGL_TRUE)
+        return false;
+
+    gl_context_state_bind(context->state);
+    return true;
+}
+
+void gl_headless_context_release_current(GL_Headless_Context* context)
+{
+    eglMakeCurrent(context->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if(context->state && gl_context_state_get_bound() == context->state)
+        gl_context_state_bind(NULL);
+}
+
+//Creates a core profile context of at least the given version and makes it current on the calling thread.
+//If share_with_or_null is given the new context shares objects with it (and uses its display).
+bool gl_headless_context_init(GL_Headless_Context* context, i32 major, i32 minor, const GL_Headless_Context* share_with_or_null)
+{
+    gl_headless_context_deinit(context);
+    context->state = (GL_Context_State*) calloc(1, sizeof(GL_Context_State));
+
+    //Shared contexts take a reference as well so that the display outlives them even if the context 
+    // they share with is deinited first.
+    if(share_with_or_null)
+    {
+        context->display = share_with_or_null->display;
+        context->has_display_ref = _gl_headless_display_acquire(context->display);
+        if(context->has_display_ref == false)
+        {
+            LOG_ERROR("RENDER", "gl_headless_context_init: could not take a reference to the display of the shared context (error 0x%x)", (int) eglGetError());
+            gl_headless_context_deinit(context);
+            return false;
+        }
+    }
+    else
+    {
+        const char* client_extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if(get_platform_display && _gl_headless_has_extension(client_extensions, "EGL_MESA_platform_surfaceless"))
+            context->display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+
+        if(context->display == EGL_NO_DISPLAY)
+            context->display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+        context->has_display_ref = context->display != EGL_NO_DISPLAY && _gl_headless_display_acquire(context->display);
+        if(context->has_display_ref == false)
+        {
+            LOG_ERROR("RENDER", "gl_headless_context_init: could not initialize an EGL display (error 0x%x)", (int) eglGetError());
+            gl_headless_context_deinit(context);
+            return false;
+        }
+    }
+
+    const char* display_extensions = eglQueryString(context->display, EGL_EXTENSIONS);
+    bool is_surfaceless = _gl_headless_has_extension(display_extensions, "EGL_KHR_surfaceless_context");
+
+    EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE, is_surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_NONE
+    };
+
+    EGLint config_count = 0;
+    EGLint context_attributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, major,
+        EGL_CONTEXT_MINOR_VERSION, minor,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE
+    };
+
+    bool state = eglBindAPI(EGL_OPENGL_API) == EGL_TRUE
+        && eglChooseConfig(context->display, config_attributes, &context->config, 1, &config_count) == EGL_TRUE
+        && config_count > 0;
+
+    if(state)
+    {
+        EGLContext share = share_with_or_null ? share_with_or_null->context : EGL_NO_CONTEXT;
+        context->context = eglCreateContext(context->display, context->config, share, context_attributes);
+        state = context->context != EGL_NO_CONTEXT;
+    }
+
+    if(state && is_surfaceless == false)
+    {
+        EGLint pbuffer_attributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+        context->surface = eglCreatePbufferSurface(context->display, context->config, pbuffer_attributes);
+        state = context->surface != EGL_NO_SURFACE;
+    }
+
+    state = state && gl_headless_context_make_current(context);
+    if(state)
+    {
+        context->gl_version = gladLoadGL((GLADloadfunc) eglGetProcAddress);
+        state = context->gl_version != 0;
+    }
+
+    if(state == false)
+    {
+        LOG_ERROR("RENDER", "gl_headless_context_init: could not create a headless %i.%i context (error 0x%x)", major, minor, (int) eglGetError());
+        gl_headless_context_deinit(context);
+    }
+    else
+        LOG_INFO("RENDER", "gl_headless_context_init: created %s context on '%s'", is_surfaceless ? "surfaceless" : "pbuffer", (const char*) glGetString(GL_RENDERER));
+
+    return state;
+}
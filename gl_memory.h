@@ -0,0 +1,332 @@
+#pragma once
+
+//Accounting of the GPU memory of textures, renderbuffers and buffers created by this library. Every object is
+// recorded with its estimated size and the name of its owner (the name field of frame buffers and render targets)
+// so that it is visible where hundreds of MB went (ie. a GL_RGB32F MSAA framebuffer at 4K).
+//
+//Nothing is tracked until a tracker is made current with gl_memory_tracker_set_current. GPU memory belongs to the
+// device and not a context so there is a single current tracker for the whole process, guarded by a mutex.
+//Library functions call gl_memory_check_budget before allocating: when the allocation would go over the budget
+// the over_budget callback gets a chance to free something (drop caches, lower resolution) and if it does not
+// and enforce_budget is set the allocation fails. The check does not reserve anything so concurrent allocations
+// from several threads can overshoot a little.
+//
+//Sizes are estimates: 3 channel formats are counted as 4 channels (which is how drivers store them), multisampled
+// storage as samples times the single sampled size and no alignment or compression is taken into account.
+//Objects created by the caller (gl_worker uploads, gl_mip_chain_make_texture) are not tracked unless the caller
+// does so with gl_memory_track.
+//
+//GL names are only unique within a context, so every object also records the GL_Context_State of the context it was
+// tracked on (gl_context_state() of the calling thread) and gl_memory_untrack only matches objects of the current one.
+// An object has to be untracked on the same context (and state binding) it was tracked on.
+
+#include "gl.h"
+#include "gl_pixel_format.h"
+#include "gl_context_state.h"
+#include "../lib/platform.h"
+#include "../lib/log.h"
+
+#ifndef GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX
+    #define GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX 0x9047
+    #define GL_GPU_MEMORY_INFO_TOTAL_AVAILABLE_MEMORY_NVX 0x9048
+    #define GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX 0x9049
+#endif
+
+#ifndef GL_TEXTURE_FREE_MEMORY_ATI
+    #define GL_TEXTURE_FREE_MEMORY_ATI 0x87FC
+#endif
+
+typedef enum {
+    GL_MEMORY_TEXTURE,
+    GL_MEMORY_RENDERBUFFER,
+    GL_MEMORY_BUFFER,
+    GL_MEMORY_CATEGORY_COUNT,
+} GL_Memory_Category;
+
+enum {GL_MEMORY_MAX_NAME = 64};
+
+typedef struct GL_Memory_Allocation {
+    GLuint handle;
+    const GL_Context_State* context; //the context the handle belongs to
+    GL_Memory_Category category;
+    i64 bytes;
+    char name[GL_MEMORY_MAX_NAME];
+} GL_Memory_Allocation;
+
+typedef Array(GL_Memory_Allocation) GL_Memory_Allocation_Array;
+
+typedef struct GL_Memory_Tracker GL_Memory_Tracker;
+
+//Called when allocating requested_bytes for name would go over the budget. Return true after freeing
+// memory to have the budget checked once more. Called without the trackers mutex held.
+typedef bool (*GL_Memory_Over_Budget_Func)(void* context, GL_Memory_Tracker* tracker, i64 requested_bytes, const char* name);
+
+struct GL_Memory_Tracker {
+    Platform_Mutex mutex;
+    GL_Memory_Allocation_Array allocations;
+
+    i64 totals[GL_MEMORY_CATEGORY_COUNT];
+    i64 total;
+    i64 peak;
+
+    i64 budget;                             //0 means unlimited
+    bool enforce_budget;                    //when false going over the budget only logs and calls over_budget
+    GL_Memory_Over_Budget_Func over_budget; //can be NULL
+    void* over_budget_context;
+};
+
+//Memory as reported by the driver. Only available on NVIDIA (GL_NVX_gpu_memory_info) and AMD (GL_ATI_meminfo).
+typedef struct GL_Memory_Device_Info {
+    bool available;
+    i64 dedicated_bytes; //0 if unknown
+    i64 free_bytes;
+} GL_Memory_Device_Info;
+
+//Set from one thread and read from all that allocate so it is accessed atomically
+static GL_Memory_Tracker* volatile _gl_memory_tracker = NULL;
+
+#if defined(_MSC_VER)
+    #include <intrin.h>
+    INTERNAL GL_Memory_Tracker* _gl_memory_tracker_load()
+    {
+        return (GL_Memory_Tracker*) _InterlockedCompareExchangePointer((void* volatile*) &_gl_memory_tracker, NULL, NULL);
+    }
+
+    INTERNAL void _gl_memory_tracker_store(GL_Memory_Tracker* tracker)
+    {
+        _InterlockedExchangePointer((void* volatile*) &_gl_memory_tracker, tracker);
+    }
+#else
+    INTERNAL GL_Memory_Tracker* _gl_memory_tracker_load()
+    {
+        return __atomic_load_n(&_gl_memory_tracker, __ATOMIC_ACQUIRE);
+    }
+
+    INTERNAL void _gl_memory_tracker_store(GL_Memory_Tracker* tracker)
+    {
+        __atomic_store_n(&_gl_memory_tracker, tracker, __ATOMIC_RELEASE);
+    }
+#endif
+
+const char* gl_memory_category_to_string(GL_Memory_Category category)
+{
+    switch(category)
+    {
+        case GL_MEMORY_TEXTURE:      return "texture";
+        case GL_MEMORY_RENDERBUFFER: return "renderbuffer";
+        case GL_MEMORY_BUFFER:       return "buffer";
+        default:                     return "invalid";
+    }
+}
+
+void gl_memory_tracker_init(GL_Memory_Tracker* tracker, Allocator* alloc, i64 budget, bool enforce_budget)
+{
+    memset(tracker, 0, sizeof *tracker);
+    platform_mutex_init(&tracker->mutex);
+    tracker->allocations.allocator = alloc;
+    tracker->budget = budget;
+    tracker->enforce_budget = enforce_budget;
+}
+
+void gl_memory_tracker_deinit(GL_Memory_Tracker* tracker)
+{
+    if(_gl_memory_tracker_load() == tracker)
+        _gl_memory_tracker_store(NULL);
+
+    array_deinit(&tracker->allocations);
+    platform_mutex_deinit(&tracker->mutex);
+    memset(tracker, 0, sizeof *tracker);
+}
+
+//Makes tracker receive all following allocations. NULL turns tracking off.
+//Objects created before are not known to it, so this should be done right after context creation.
+void gl_memory_tracker_set_current(GL_Memory_Tracker* tracker)
+{
+    _gl_memory_tracker_store(tracker);
+}
+
+GL_Memory_Tracker* gl_memory_tracker_get_current()
+{
+    return _gl_memory_tracker_load();
+}
+
+//Estimated bytes per texel of a sized internal format. Returns 0 for unknown formats.
+i64 gl_memory_format_bytes(GLenum internal_format)
+{
+    switch(internal_format)
+    {
+        case GL_STENCIL_INDEX8:       return 1;
+        case GL_DEPTH_COMPONENT16:    return 2;
+        case GL_DEPTH_COMPONENT24:    return 4;
+        case GL_DEPTH_COMPONENT32:    return 4;
+        case GL_DEPTH_COMPONENT32F:   return 4;
+        case GL_DEPTH24_STENCIL8:     return 4;
+        case GL_DEPTH32F_STENCIL8:    return 8;
+        case GL_RGB10_A2:
+        case GL_RGB10_A2UI:
+        case GL_R11F_G11F_B10F:
+        case GL_RGB9_E5:
+        case GL_SRGB8:
+        case GL_SRGB8_ALPHA8:         return 4;
+    }
+
+    i32 channels = 0;
+    Pixel_Type type = pixel_type_from_gl_internal_format(internal_format, &channels);
+    if(type == PIXEL_TYPE_INVALID)
+        return 0;
+
+    return (i64) pixel_type_size(type) * (channels == 3 ? 4 : channels);
+}
+
+//Estimated size of texture storage. levels of 0 means the full mip chain. samples of 0 or 1 means not multisampled.
+i64 gl_memory_texture_bytes(GLenum internal_format, i32 width, i32 height, i32 depth, i32 levels, i32 samples)
+{
+    i64 texel_bytes = gl_memory_format_bytes(internal_format);
+    i64 bytes = 0;
+    for(i32 level = 0; levels <= 0 || level < levels; level++)
+    {
+        bytes += (i64) MAX(width >> level, 1) * MAX(height >> level, 1) * MAX(depth, 1) * texel_bytes;
+        if((width >> level) <= 1 && (height >> level) <= 1)
+            break;
+    }
+    return bytes * MAX(samples, 1);
+}
+
+//Returns true if bytes more can be allocated for name. See the top of this file.
+bool gl_memory_check_budget(i64 bytes, const char* name)
+{
+    GL_Memory_Tracker* tracker = _gl_memory_tracker_load();
+    if(tracker == NULL || tracker->budget <= 0)
+        return true;
+
+    for(i32 attempt = 0; ; attempt++)
+    {
+        platform_mutex_lock(&tracker->mutex);
+        i64 total = tracker->total;
+        platform_mutex_unlock(&tracker->mutex);
+
+        if(total + bytes <= tracker->budget)
+            return true;
+
+        if(attempt == 0 && tracker->over_budget && tracker->over_budget(tracker->over_budget_context, tracker, bytes, name))
+            continue;
+
+        LOG_ERROR("RENDER", "gl_memory: '%s' needs %.2lf MB which is over the budget (%.2lf of %.2lf MB used)%s", name,
+            (f64) bytes / 1e6, (f64) total / 1e6, (f64) tracker->budget / 1e6, tracker->enforce_budget ? "" : ". Allowing anyway");
+        return tracker->enforce_budget == false;
+    }
+}
+
+//Records an object of the current context. Handles of 0 are ignored so this can be called unconditionally after creation.
+void gl_memory_track(GL_Memory_Category category, GLuint handle, i64 bytes, const char* name)
+{
+    GL_Memory_Tracker* tracker = _gl_memory_tracker_load();
+    if(tracker == NULL || handle == 0)
+        return;
+
+    GL_Memory_Allocation allocation = {0};
+    allocation.handle = handle;
+    allocation.context = gl_context_state();
+    allocation.category = category;
+    allocation.bytes = bytes;
+    if(name)
+        strncpy(allocation.name, name, GL_MEMORY_MAX_NAME - 1);
+
+    platform_mutex_lock(&tracker->mutex);
+    array_push(&tracker->allocations, allocation);
+    tracker->totals[category] += bytes;
+    tracker->total += bytes;
+    tracker->peak = MAX(tracker->peak, tracker->total);
+    platform_mutex_unlock(&tracker->mutex);
+}
+
+//Removes the object of the current context. Must be called before the handle is deleted (since it could be reused right after).
+//Unknown handles are ignored.
+void gl_memory_untrack(GL_Memory_Category category, GLuint handle)
+{
+    GL_Memory_Tracker* tracker = _gl_memory_tracker_load();
+    if(tracker == NULL || handle == 0)
+        return;
+
+    const GL_Context_State* context = gl_context_state();
+    platform_mutex_lock(&tracker->mutex);
+    for(isize i = tracker->allocations.len; i-- > 0; )
+    {
+        GL_Memory_Allocation* allocation = &tracker->allocations.data[i];
+        if(allocation->handle == handle && allocation->category == category && allocation->context == context)
+        {
+            tracker->totals[category] -= allocation->bytes;
+            tracker->total -= allocation->bytes;
+            *allocation = *array_last(tracker->allocations);
+            array_pop(&tracker->allocations);
+            break;
+        }
+    }
+    platform_mutex_unlock(&tracker->mutex);
+}
+
+//Sum of all objects whose name is exactly name
+i64 gl_memory_bytes_of(GL_Memory_Tracker* tracker, const char* name)
+{
+    i64 bytes = 0;
+    platform_mutex_lock(&tracker->mutex);
+    for(isize i = 0; i < tracker->allocations.len; i++)
+        if(strncmp(tracker->allocations.data[i].name, name, GL_MEMORY_MAX_NAME) == 0)
+            bytes += tracker->allocations.data[i].bytes;
+    platform_mutex_unlock(&tracker->mutex);
+    return bytes;
+}
+
+INTERNAL bool _gl_memory_has_extension(const char* extension)
+{
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for(GLint i = 0; i < count; i++)
+    {
+        const char* name = (const char*) glGetStringi(GL_EXTENSIONS, (GLuint) i);
+        if(name && strcmp(name, extension) == 0)
+            return true;
+    }
+    return false;
+}
+
+//Queries the driver for the real memory situation. Returns available = false if neither extension is supported.
+GL_Memory_Device_Info gl_memory_query_device()
+{
+    GL_Memory_Device_Info info = {0};
+    if(_gl_memory_has_extension("GL_NVX_gpu_memory_info"))
+    {
+        GLint dedicated_kb = 0;
+        GLint free_kb = 0;
+        glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &dedicated_kb);
+        glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &free_kb);
+        info.available = true;
+        info.dedicated_bytes = (i64) dedicated_kb * 1024;
+        info.free_bytes = (i64) free_kb * 1024;
+    }
+    else if(_gl_memory_has_extension("GL_ATI_meminfo"))
+    {
+        //total free, largest free block, total auxiliary free, largest auxiliary free block
+        GLint texture_kb[4] = {0};
+        glGetIntegerv(GL_TEXTURE_FREE_MEMORY_ATI, texture_kb);
+        info.available = true;
+        info.free_bytes = (i64) texture_kb[0] * 1024;
+    }
+    return info;
+}
+
+void gl_memory_tracker_log(GL_Memory_Tracker* tracker)
+{
+    platform_mutex_lock(&tracker->mutex);
+    LOG_INFO("RENDER", "gl_memory: %.2lf MB in %lli objects (peak %.2lf MB, budget %.2lf MB)",
+        (f64) tracker->total / 1e6, (long long) tracker->allocations.len, (f64) tracker->peak / 1e6, (f64) tracker->budget / 1e6);
+    for(i32 i = 0; i < GL_MEMORY_CATEGORY_COUNT; i++)
+        LOG_INFO("RENDER", "    %-12s %10.2lf MB", gl_memory_category_to_string((GL_Memory_Category) i), (f64) tracker->totals[i] / 1e6);
+    for(isize i = 0; i < tracker->allocations.len; i++)
+    {
+        GL_Memory_Allocation* allocation = &tracker->allocations.data[i];
+        LOG_INFO("RENDER", "    %-12s %6u %10.2lf MB '%s'", gl_memory_category_to_string(allocation->category),
+            allocation->handle, (f64) allocation->bytes / 1e6, allocation->name);
+    }
+    platform_mutex_unlock(&tracker->mutex);
+}
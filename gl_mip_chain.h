@@ -0,0 +1,353 @@
+#pragma once
+
+//Mip chain generation with compute shaders as a replacement for glGenerateMipmap, which is slow on many drivers
+// and does not support integer formats at all. Each dispatch of shaders/mip_chain.comp produces up to
+// GL_MIP_CHAIN_MAX_LEVELS_PER_PASS levels (the workgroup keeps reducing its tile in shared memory) so a full chain
+// of a power of two texture up to 4096 takes two dispatches. Odd sized levels end a dispatch early since their
+// last texel needs data from the neighbouring workgroup.
+//
+//The filter is picked per call and compiled into the kernel together with the format:
+// average (the usual box filter), min and max (depth pyramids for occlusion culling, conservative bounds)
+// and first (the top left texel, for ids and other values that must not be blended).
+//Kernels are compiled lazily the first time a format/filter combination is used.
+//
+//The texture needs to be image load/store compatible which excludes the 3 channel formats. For those
+// GL_MIP_FILTER_AVERAGE falls back to glGenerateMipmap, the rest is rejected.
+//Depth textures cannot be bound as images so for depth pyramids gl_mip_chain_generate_from samples
+// the depth texture and writes into a separate GL_R32F pyramid (see gl_mip_chain_make_texture).
+
+#include "gl.h"
+#include "gl_shader_util.h"
+#include "../lib/log.h"
+
+typedef enum {
+    GL_MIP_FILTER_AVERAGE,
+    GL_MIP_FILTER_MIN,
+    GL_MIP_FILTER_MAX,
+    GL_MIP_FILTER_FIRST,
+    GL_MIP_FILTER_COUNT,
+} GL_Mip_Filter;
+
+enum {
+    GL_MIP_CHAIN_MAX_LEVELS_PER_PASS = 6,
+};
+
+typedef struct _GL_Mip_Kernel {
+    GLuint internal_format;
+    GL_Mip_Filter filter;
+    bool input_sampler;
+    bool ok;
+    GL_Shader shader;
+} _GL_Mip_Kernel;
+
+typedef Array(_GL_Mip_Kernel) _GL_Mip_Kernel_Array;
+
+typedef struct GL_Mip_Chain {
+    Shader_File_Cache* cache;
+    String_Builder kernel_path;
+    _GL_Mip_Kernel_Array kernels;
+    isize block_size;      //workgroup is block_size x block_size
+    isize levels_per_pass; //log2(block_size) + 1
+} GL_Mip_Chain;
+
+typedef struct _GL_Mip_Image_Format {
+    GLuint internal_format;
+    const char* layout;
+    const char* value; //VALUE_FLOAT, VALUE_INT, VALUE_UINT
+} _GL_Mip_Image_Format;
+
+//The image compatible formats gl_pixel_format_from_pixel_type can produce
+INTERNAL const _GL_Mip_Image_Format* _gl_mip_image_format(GLuint internal_format)
+{
+    static const _GL_Mip_Image_Format formats[] = {
+        {GL_R8, "r8", "VALUE_FLOAT"},          {GL_RG8, "rg8", "VALUE_FLOAT"},          {GL_RGBA8, "rgba8", "VALUE_FLOAT"},
+        {GL_R16, "r16", "VALUE_FLOAT"},        {GL_RG16, "rg16", "VALUE_FLOAT"},        {GL_RGBA16, "rgba16", "VALUE_FLOAT"},
+        {GL_R16F, "r16f", "VALUE_FLOAT"},      {GL_RG16F, "rg16f", "VALUE_FLOAT"},      {GL_RGBA16F, "rgba16f", "VALUE_FLOAT"},
+        {GL_R32F, "r32f", "VALUE_FLOAT"},      {GL_RG32F, "rg32f", "VALUE_FLOAT"},      {GL_RGBA32F, "rgba32f", "VALUE_FLOAT"},
+        {GL_R8I, "r8i", "VALUE_INT"},          {GL_RG8I, "rg8i", "VALUE_INT"},          {GL_RGBA8I, "rgba8i", "VALUE_INT"},
+        {GL_R16I, "r16i", "VALUE_INT"},        {GL_RG16I, "rg16i", "VALUE_INT"},        {GL_RGBA16I, "rgba16i", "VALUE_INT"},
+        {GL_R32I, "r32i", "VALUE_INT"},        {GL_RG32I, "rg32i", "VALUE_INT"},        {GL_RGBA32I, "rgba32i", "VALUE_INT"},
+        {GL_R8UI, "r8ui", "VALUE_UINT"},       {GL_RG8UI, "rg8ui", "VALUE_UINT"},       {GL_RGBA8UI, "rgba8ui", "VALUE_UINT"},
+        {GL_R16UI, "r16ui", "VALUE_UINT"},     {GL_RG16UI, "rg16ui", "VALUE_UINT"},     {GL_RGBA16UI, "rgba16ui", "VALUE_UINT"},
+        {GL_R32UI, "r32ui", "VALUE_UINT"},     {GL_RG32UI, "rg32ui", "VALUE_UINT"},     {GL_RGBA32UI, "rgba32ui", "VALUE_UINT"},
+    };
+
+    for(isize i = 0; i < (isize) (sizeof formats / sizeof formats[0]); i++)
+        if(formats[i].internal_format == internal_format)
+            return &formats[i];
+    return NULL;
+}
+
+INTERNAL const char* _gl_mip_filter_define(GL_Mip_Filter filter)
+{
+    switch(filter)
+    {
+        case GL_MIP_FILTER_MIN:   return "FILTER_MIN";
+        case GL_MIP_FILTER_MAX:   return "FILTER_MAX";
+        case GL_MIP_FILTER_FIRST: return "FILTER_FIRST";
+        default:                  return "FILTER_AVERAGE";
+    }
+}
+
+void gl_mip_chain_deinit(GL_Mip_Chain* chain)
+{
+    for(isize i = 0; i < chain->kernels.len; i++)
+    {
+        GL_Shader* shader = &chain->kernels.data[i].shader;
+        if(shader->handle != 0)
+        {
+            render_shader_unuse(shader);
+            glDeleteProgram(shader->handle);
+        }
+    }
+
+    array_deinit(&chain->kernels);
+    builder_deinit(&chain->kernel_path);
+    memset(chain, 0, sizeof *chain);
+}
+
+//kernel_directory is the shaders/ directory of this library. Nothing is compiled yet.
+void gl_mip_chain_init(GL_Mip_Chain* chain, Allocator* alloc, Shader_File_Cache* cache, String kernel_directory)
+{
+    gl_mip_chain_deinit(chain);
+    chain->cache = cache;
+    chain->kernels.allocator = alloc;
+    chain->kernel_path = builder_make(alloc, 0);
+    SCRATCH_ARENA(arena)
+    {
+        String path = format(arena.alloc, "%.*s/mip_chain.comp", STRING_PRINT(kernel_directory));
+        builder_assign(&chain->kernel_path, path);
+    }
+
+    //Largest power of two square workgroup. 32 x 32 is guaranteed by GL 4.3 and gives 6 levels per dispatch.
+    Compute_Shader_Limits limits = compute_shader_query_limits();
+    isize max_block_size = MIN(limits.max_group_size[0], limits.max_group_size[1]);
+    chain->block_size = 1;
+    chain->levels_per_pass = 1;
+    while(chain->levels_per_pass < GL_MIP_CHAIN_MAX_LEVELS_PER_PASS
+        && chain->block_size*2 <= max_block_size
+        && chain->block_size*chain->block_size*4 <= limits.max_group_invocations)
+    {
+        chain->block_size *= 2;
+        chain->levels_per_pass += 1;
+    }
+}
+
+INTERNAL _GL_Mip_Kernel* _gl_mip_chain_kernel(GL_Mip_Chain* chain, const _GL_Mip_Image_Format* image_format, GL_Mip_Filter filter, bool input_sampler)
+{
+    for(isize i = 0; i < chain->kernels.len; i++)
+    {
+        _GL_Mip_Kernel* kernel = &chain->kernels.data[i];
+        if(kernel->internal_format == image_format->internal_format && kernel->filter == filter && kernel->input_sampler == input_sampler)
+            return kernel->ok ? kernel : NULL;
+    }
+
+    _GL_Mip_Kernel kernel = {0};
+    kernel.internal_format = image_format->internal_format;
+    kernel.filter = filter;
+    kernel.input_sampler = input_sampler;
+    SCRATCH_ARENA(arena)
+    {
+        String defines = format(arena.alloc, "#define %s\n#define %s\n#define IMAGE_FORMAT %s\n#define MAX_LEVELS %i\n%s",
+            _gl_mip_filter_define(filter), image_format->value, image_format->layout, (int) GL_MIP_CHAIN_MAX_LEVELS_PER_PASS,
+            input_sampler ? "#define INPUT_SAMPLER\n" : "");
+        compute_shader_init_from_disk_with_defines(chain->cache, &kernel.shader, chain->kernel_path.string, chain->block_size, chain->block_size, 1, defines);
+        kernel.ok = kernel.shader.handle != 0;
+    }
+
+    //Failed kernels are remembered as well so that the error is logged only once
+    array_push(&chain->kernels, kernel);
+    return kernel.ok ? array_last(chain->kernels) : NULL;
+}
+
+//Runs the passes filling target levels [first_level, first_level + level_count). The source of first_level has source_size
+// and is either the level before it in target or (for input_sampler) the given level of a separate texture bound to unit 0.
+//Returns false if a pass could not be dispatched.
+INTERNAL bool _gl_mip_chain_run(GL_Mip_Chain* chain, _GL_Mip_Kernel* kernel, GLuint target, i32 first_level, i32 level_count, i32 source_width, i32 source_height, GLuint sampler_texture, i32 sampler_level)
+{
+    GL_Shader* shader = &kernel->shader;
+    i32 level = first_level;
+    i32 end = first_level + level_count;
+    bool from_sampler = sampler_texture != 0;
+    bool state = true;
+    while(level < end)
+    {
+        //As many levels as the workgroup tile allows, stopping after a level with an odd dimension
+        i32 pass_levels = 0;
+        i32 width = source_width;
+        i32 height = source_height;
+        while(level + pass_levels < end && pass_levels < chain->levels_per_pass)
+        {
+            width = MAX(width/2, 1);
+            height = MAX(height/2, 1);
+            pass_levels += 1;
+
+            bool width_ok = width == 1 || width % 2 == 0;
+            bool height_ok = height == 1 || height % 2 == 0;
+            if(width_ok == false || height_ok == false)
+                break;
+        }
+
+        if(from_sampler)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, sampler_texture);
+            render_shader_set_i32(shader, "u_source_sampler", 0);
+            render_shader_set_i32(shader, "u_source_level", sampler_level);
+        }
+        else
+            glBindImageTexture(0, target, level - 1, GL_FALSE, 0, GL_READ_ONLY, kernel->internal_format);
+
+        for(i32 i = 0; i < GL_MIP_CHAIN_MAX_LEVELS_PER_PASS; i++)
+        {
+            //Units of levels past this pass are never written but still need something valid bound
+            i32 dest_level = level + MIN(i, pass_levels - 1);
+            glBindImageTexture((GLuint) (1 + i), target, dest_level, GL_FALSE, 0, GL_WRITE_ONLY, kernel->internal_format);
+        }
+
+        GLint source_size[2] = {source_width, source_height};
+        render_shader_use(shader);
+        glUniform2iv(glGetUniformLocation(shader->handle, "u_source_size"), 1, source_size);
+        render_shader_set_i32(shader, "u_level_count", pass_levels);
+        state = compute_shader_dispatch(shader, MAX(source_width/2, 1), MAX(source_height/2, 1), 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        if(state == false)
+            break;
+
+        level += pass_levels;
+        source_width = width;
+        source_height = height;
+
+        //Only the very first pass reads from the separate texture
+        if(from_sampler)
+        {
+            from_sampler = false;
+            kernel = _gl_mip_chain_kernel(chain, _gl_mip_image_format(kernel->internal_format), kernel->filter, false);
+            if(kernel == NULL)
+            {
+                state = false;
+                break;
+            }
+            shader = &kernel->shader;
+        }
+    }
+
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+    return state;
+}
+
+INTERNAL i32 _gl_mip_chain_level_count(GLuint texture, i32* width, i32* height, GLuint* internal_format)
+{
+    GLint w = 0, h = 0, format = 0, immutable = 0, immutable_levels = 0;
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &w);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &h);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+    glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_LEVELS, &immutable_levels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    i32 levels = 1;
+    while((MAX(w, h) >> levels) > 0)
+        levels += 1;
+    if(immutable)
+        levels = MIN(levels, immutable_levels);
+
+    *width = w;
+    *height = h;
+    *internal_format = (GLuint) format;
+    return levels;
+}
+
+//Creates an immutable GL_TEXTURE_2D with the full mip chain and nearest filtering, for example the GL_R32F
+// depth pyramid of a width*2 x height*2 depth buffer.
+GLuint gl_mip_chain_make_texture(i32 width, i32 height, GLuint internal_format)
+{
+    i32 levels = 1;
+    while((MAX(width, height) >> levels) > 0)
+        levels += 1;
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, internal_format, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+//Fills all mip levels of a GL_TEXTURE_2D past level 0 from level 0. For mutable textures every level
+// has to be allocated already.
+bool gl_mip_chain_generate(GL_Mip_Chain* chain, GLuint texture, GL_Mip_Filter filter)
+{
+    ASSERT(0 <= filter && filter < GL_MIP_FILTER_COUNT);
+    i32 width = 0, height = 0;
+    GLuint internal_format = 0;
+    i32 levels = _gl_mip_chain_level_count(texture, &width, &height, &internal_format);
+    if(levels <= 1)
+        return true;
+
+    const _GL_Mip_Image_Format* image_format = _gl_mip_image_format(internal_format);
+    if(image_format == NULL)
+    {
+        bool is_integer = false;
+        glBindTexture(GL_TEXTURE_2D, texture);
+        GLint red_type = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_RED_TYPE, &red_type);
+        is_integer = red_type == GL_INT || red_type == GL_UNSIGNED_INT;
+        if(filter == GL_MIP_FILTER_AVERAGE && is_integer == false)
+            glGenerateMipmap(GL_TEXTURE_2D);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        if(filter == GL_MIP_FILTER_AVERAGE && is_integer == false)
+            return true;
+
+        LOG_ERROR("RENDER", "gl_mip_chain_generate: internal format 0x%x cannot be bound as an image", (unsigned) internal_format);
+        return false;
+    }
+
+    _GL_Mip_Kernel* kernel = _gl_mip_chain_kernel(chain, image_format, filter, false);
+    if(kernel == NULL)
+        return false;
+
+    return _gl_mip_chain_run(chain, kernel, texture, 1, levels - 1, width, height, 0, 0);
+}
+
+//Fills all levels of target (starting with level 0) from source_level of source. The size of target level 0 has to be
+// half of the source level (rounded down, at least 1). source is sampled with texelFetch so it can be a depth texture
+// as long as GL_TEXTURE_COMPARE_MODE is GL_NONE. Uses texture unit 0.
+//ie. the depth pyramid for occlusion culling: target is GL_R32F and filter is GL_MIP_FILTER_MAX (GL_MIP_FILTER_MIN for reversed z).
+bool gl_mip_chain_generate_from(GL_Mip_Chain* chain, GLuint source, i32 source_level, GLuint target, GL_Mip_Filter filter)
+{
+    ASSERT(0 <= filter && filter < GL_MIP_FILTER_COUNT);
+    GLint source_width = 0, source_height = 0;
+    glBindTexture(GL_TEXTURE_2D, source);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, source_level, GL_TEXTURE_WIDTH, &source_width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, source_level, GL_TEXTURE_HEIGHT, &source_height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    i32 width = 0, height = 0;
+    GLuint internal_format = 0;
+    i32 levels = _gl_mip_chain_level_count(target, &width, &height, &internal_format);
+    if(width != MAX(source_width/2, 1) || height != MAX(source_height/2, 1))
+    {
+        LOG_ERROR("RENDER", "gl_mip_chain_generate_from: target of %i x %i is not half of the %i x %i source", width, height, source_width, source_height);
+        return false;
+    }
+
+    const _GL_Mip_Image_Format* image_format = _gl_mip_image_format(internal_format);
+    if(image_format == NULL)
+    {
+        LOG_ERROR("RENDER", "gl_mip_chain_generate_from: internal format 0x%x cannot be bound as an image", (unsigned) internal_format);
+        return false;
+    }
+
+    _GL_Mip_Kernel* kernel = _gl_mip_chain_kernel(chain, image_format, filter, true);
+    if(kernel == NULL)
+        return false;
+
+    return _gl_mip_chain_run(chain, kernel, target, 0, levels, source_width, source_height, source, source_level);
+}
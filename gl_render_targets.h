@@ -0,0 +1,354 @@
+#pragma once
+
+//Framebuffer with multiple color attachments (G-buffer) so that geometry can be drawn once while writing
+// all surface data in a single pass. All attachments are textures with immutable storage. When multisampled
+// each attachment that asks for it gets a single sampled texture which render_targets_resolve resolves into.
+//GL requires all attachments of a framebuffer to have the same sample count so it is shared by all of them.
+//
+//Images bigger than a framebuffer can be (GL_MAX_TEXTURE_SIZE, GL_MAX_VIEWPORT_DIMS...) are rendered in tiles:
+// the image is split with render_tile_get and every tile is rendered with the projection of the whole image
+// followed by the tile transform in the vertex shader (RENDER_TILE_GLSL) which maps the part of clip space covered
+// by the tile onto the viewport. Screen space effects reaching across tile edges (blurs, derivatives) can show seams.
+
+#include "gl.h"
+#include "gl_pixel_format.h"
+#include "gl_memory.h"
+#include "../lib/string.h"
+#include "../lib/log.h"
+
+enum {RENDER_TARGETS_MAX_ATTACHMENTS = 8};
+
+//Apply right after computing gl_Position. Identity (scale 1, offset 0) when not tiled.
+#define RENDER_TILE_GLSL \
+    "uniform vec2 u_tile_scale;\n" \
+    "uniform vec2 u_tile_offset;\n" \
+    "vec4 render_tile_transform(vec4 clip) { return vec4(clip.xy * u_tile_scale + u_tile_offset * clip.w, clip.zw); }\n"
+
+typedef struct Render_Tile {
+    i32 x;          //the rect of the tile within the whole image in pixels
+    i32 y;
+    i32 width;
+    i32 height;
+    f32 scale[2];   //u_tile_scale
+    f32 offset[2];  //u_tile_offset
+} Render_Tile;
+
+typedef struct Render_Target_Attachment_Desc {
+    GL_Pixel_Format format; //only internal_format is used
+    bool resolve;           //only used when multisampled. Creates the resolved texture for this attachment
+} Render_Target_Attachment_Desc;
+
+typedef struct Render_Target_Attachment {
+    GLuint texture;          //GL_TEXTURE_2D_MULTISAMPLE when sample_count > 1 else GL_TEXTURE_2D
+    GLuint resolved_texture; //0 when not multisampled or not resolved
+    GL_Pixel_Format format;
+} Render_Target_Attachment;
+
+typedef struct Render_Targets {
+    GLuint frame_buff;
+    GLuint resolve_frame_buff;
+    GLuint depth_stencil_texture;
+    GLenum depth_stencil_format;
+
+    Render_Target_Attachment attachments[RENDER_TARGETS_MAX_ATTACHMENTS];
+    i32 attachment_count;
+    i32 sample_count;
+
+    i32 width;
+    i32 height;
+    Render_Tile tile; //the part of the whole image currently rendered. Covers the targets unless tiled
+
+    String_Builder name;
+} Render_Targets;
+
+//The biggest size a framebuffer can have on this context
+void render_targets_query_max_size(i32* width, i32* height)
+{
+    GLint max_texture_size = 0;
+    GLint max_renderbuffer_size = 0;
+    GLint max_viewport[2] = {0};
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_renderbuffer_size);
+    glGetIntegerv(GL_MAX_VIEWPORT_DIMS, max_viewport);
+    *width = MAX(MIN(MIN(max_texture_size, max_renderbuffer_size), max_viewport[0]), 1);
+    *height = MAX(MIN(MIN(max_texture_size, max_renderbuffer_size), max_viewport[1]), 1);
+
+    if(GLAD_GL_VERSION_4_3)
+    {
+        GLint max_frame_buff_width = 0;
+        GLint max_frame_buff_height = 0;
+        glGetIntegerv(GL_MAX_FRAMEBUFFER_WIDTH, &max_frame_buff_width);
+        glGetIntegerv(GL_MAX_FRAMEBUFFER_HEIGHT, &max_frame_buff_height);
+        *width = MAX(MIN(*width, max_frame_buff_width), 1);
+        *height = MAX(MIN(*height, max_frame_buff_height), 1);
+    }
+}
+
+//The tile covering the pixels [x, x + width) x [y, y + height) of an image_width x image_height image
+Render_Tile render_tile_make(i32 image_width, i32 image_height, i32 x, i32 y, i32 width, i32 height)
+{
+    //Maps the clip space range of the tile [2x/W - 1, 2(x + w)/W - 1] onto [-1, 1]
+    Render_Tile tile = {0};
+    tile.x = x;
+    tile.y = y;
+    tile.width = width;
+    tile.height = height;
+    tile.scale[0] = (f32) image_width / (f32) width;
+    tile.scale[1] = (f32) image_height / (f32) height;
+    tile.offset[0] = -((f32) (2*x + width) / (f32) image_width - 1) * tile.scale[0];
+    tile.offset[1] = -((f32) (2*y + height) / (f32) image_height - 1) * tile.scale[1];
+    return tile;
+}
+
+isize render_tile_count(i32 image_width, i32 image_height, i32 tile_width, i32 tile_height)
+{
+    return DIV_CEIL(image_width, tile_width) * DIV_CEIL(image_height, tile_height);
+}
+
+//Returns the tile at index (row major from the bottom left) of an image split into tiles of at most tile_width x tile_height
+Render_Tile render_tile_get(i32 image_width, i32 image_height, i32 tile_width, i32 tile_height, isize index)
+{
+    isize tiles_x = DIV_CEIL(image_width, tile_width);
+    i32 x = (i32) (index % tiles_x) * tile_width;
+    i32 y = (i32) (index / tiles_x) * tile_height;
+    return render_tile_make(image_width, image_height, x, y, MIN(tile_width, image_width - x), MIN(tile_height, image_height - y));
+}
+
+//Sets the uniforms of RENDER_TILE_GLSL
+void render_tile_set_uniforms(const Render_Tile* tile, GLuint program)
+{
+    glProgramUniform2f(program, glGetUniformLocation(program, "u_tile_scale"), tile->scale[0], tile->scale[1]);
+    glProgramUniform2f(program, glGetUniformLocation(program, "u_tile_offset"), tile->offset[0], tile->offset[1]);
+}
+
+void render_targets_deinit(Render_Targets* targets)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &targets->frame_buff);
+    glDeleteFramebuffers(1, &targets->resolve_frame_buff);
+    gl_memory_untrack(GL_MEMORY_TEXTURE, targets->depth_stencil_texture);
+    glDeleteTextures(1, &targets->depth_stencil_texture);
+    for(i32 i = 0; i < targets->attachment_count; i++)
+    {
+        gl_memory_untrack(GL_MEMORY_TEXTURE, targets->attachments[i].texture);
+        gl_memory_untrack(GL_MEMORY_TEXTURE, targets->attachments[i].resolved_texture);
+        glDeleteTextures(1, &targets->attachments[i].texture);
+        glDeleteTextures(1, &targets->attachments[i].resolved_texture);
+    }
+
+    array_deinit(&targets->name);
+    memset(targets, 0, sizeof *targets);
+}
+
+INTERNAL GLuint _render_targets_make_texture(GLenum internal_format, i32 width, i32 height, i32 sample_count)
+{
+    GLuint texture = 0;
+    if(GLAD_GL_VERSION_4_5)
+    {
+        if(sample_count > 1)
+        {
+            glCreateTextures(GL_TEXTURE_2D_MULTISAMPLE, 1, &texture);
+            glTextureStorage2DMultisample(texture, sample_count, internal_format, width, height, GL_TRUE);
+        }
+        else
+        {
+            glCreateTextures(GL_TEXTURE_2D, 1, &texture);
+            glTextureStorage2D(texture, 1, internal_format, width, height);
+            glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        return texture;
+    }
+
+    glGenTextures(1, &texture);
+    if(sample_count > 1)
+    {
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, texture);
+        glTexStorage2DMultisample(GL_TEXTURE_2D_MULTISAMPLE, sample_count, internal_format, width, height, GL_TRUE);
+        glBindTexture(GL_TEXTURE_2D_MULTISAMPLE, 0);
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    return texture;
+}
+
+INTERNAL GLuint _render_targets_make_tracked_texture(Render_Targets* targets, GLenum internal_format, i32 sample_count)
+{
+    GLuint texture = _render_targets_make_texture(internal_format, targets->width, targets->height, sample_count);
+    gl_memory_track(GL_MEMORY_TEXTURE, texture, gl_memory_texture_bytes(internal_format, targets->width, targets->height, 1, 1, sample_count), targets->name.data);
+    return texture;
+}
+
+//Creates the render targets with one color attachment per desc (GL_COLOR_ATTACHMENT0 + index) and optionally a
+// depth stencil texture of depth_stencil_format (ie. GL_DEPTH24_STENCIL8, GL_DEPTH_COMPONENT32F or 0 for none).
+//sample_count of 0 or 1 means not multisampled.
+//Returns false (leaving targets empty) when the size, attachments or budget are not supported or a framebuffer is incomplete.
+bool render_targets_init(Render_Targets* targets, const char* name, i32 width, i32 height, i32 sample_count,
+    const Render_Target_Attachment_Desc* attachments, isize attachment_count, GLenum depth_stencil_format)
+{
+    render_targets_deinit(targets);
+    LOG_INFO("RENDER", "render_targets_init '%s' %-4d x %-4d samples: %d attachments: %d", name, width, height, sample_count, (int) attachment_count);
+
+    GLint max_draw_buffers = 0;
+    glGetIntegerv(GL_MAX_DRAW_BUFFERS, &max_draw_buffers);
+    if(attachment_count > RENDER_TARGETS_MAX_ATTACHMENTS || attachment_count > max_draw_buffers)
+    {
+        LOG_ERROR("RENDER", "render_targets_init '%s': too many attachments %d (max %d)", name, (int) attachment_count, (int) MIN(max_draw_buffers, RENDER_TARGETS_MAX_ATTACHMENTS));
+        return false;
+    }
+
+    i32 max_width = 0;
+    i32 max_height = 0;
+    render_targets_query_max_size(&max_width, &max_height);
+    if(width > max_width || height > max_height)
+    {
+        LOG_ERROR("RENDER", "render_targets_init '%s': size %i x %i is over the maximum of %i x %i. Render in tiles (render_tile_get)", name, width, height, max_width, max_height);
+        return false;
+    }
+
+    i64 bytes = gl_memory_texture_bytes(depth_stencil_format, width, height, 1, 1, sample_count);
+    for(isize i = 0; i < attachment_count; i++)
+    {
+        bytes += gl_memory_texture_bytes(attachments[i].format.internal_format, width, height, 1, 1, sample_count);
+        if(sample_count > 1 && attachments[i].resolve)
+            bytes += gl_memory_texture_bytes(attachments[i].format.internal_format, width, height, 1, 1, 1);
+    }
+    if(gl_memory_check_budget(bytes, name) == false)
+        return false;
+
+    targets->width = width;
+    targets->height = height;
+    targets->tile = render_tile_make(width, height, 0, 0, width, height);
+    targets->sample_count = MAX(sample_count, 1);
+    targets->attachment_count = (i32) attachment_count;
+    targets->depth_stencil_format = depth_stencil_format;
+    targets->name = builder_from_cstring(NULL, name);
+
+    glBindVertexArray(0);
+    glGenFramebuffers(1, &targets->frame_buff);
+    glBindFramebuffer(GL_FRAMEBUFFER, targets->frame_buff);
+
+    GLenum draw_buffers[RENDER_TARGETS_MAX_ATTACHMENTS] = {0};
+    GLenum texture_target = targets->sample_count > 1 ? GL_TEXTURE_2D_MULTISAMPLE : GL_TEXTURE_2D;
+    for(i32 i = 0; i < targets->attachment_count; i++)
+    {
+        Render_Target_Attachment* attachment = &targets->attachments[i];
+        attachment->format = attachments[i].format;
+        attachment->texture = _render_targets_make_tracked_texture(targets, attachment->format.internal_format, targets->sample_count);
+        draw_buffers[i] = GL_COLOR_ATTACHMENT0 + (GLenum) i;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, draw_buffers[i], texture_target, attachment->texture, 0);
+    }
+    glDrawBuffers(targets->attachment_count, draw_buffers);
+
+    if(depth_stencil_format != 0)
+    {
+        GLenum depth_attachment = depth_stencil_format == GL_DEPTH24_STENCIL8 || depth_stencil_format == GL_DEPTH32F_STENCIL8
+            ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        targets->depth_stencil_texture = _render_targets_make_tracked_texture(targets, depth_stencil_format, targets->sample_count);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, depth_attachment, texture_target, targets->depth_stencil_texture, 0);
+    }
+
+    bool state = true;
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        LOG_ERROR("RENDER", "render_targets_init '%s': frame buffer creation failed!", name);
+        state = false;
+    }
+
+    bool any_resolve = false;
+    for(isize i = 0; i < attachment_count; i++)
+        any_resolve = any_resolve || attachments[i].resolve;
+
+    //The resolve framebuffer uses the same attachment indices so resolving is a blit per attachment.
+    //It only exists when something gets resolved, a framebuffer without attachments would be incomplete.
+    if(targets->sample_count > 1 && any_resolve)
+    {
+        glGenFramebuffers(1, &targets->resolve_frame_buff);
+        glBindFramebuffer(GL_FRAMEBUFFER, targets->resolve_frame_buff);
+        for(i32 i = 0; i < targets->attachment_count; i++)
+        {
+            Render_Target_Attachment* attachment = &targets->attachments[i];
+            if(attachments[i].resolve)
+            {
+                attachment->resolved_texture = _render_targets_make_tracked_texture(targets, attachment->format.internal_format, 1);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + (GLenum) i, GL_TEXTURE_2D, attachment->resolved_texture, 0);
+            }
+        }
+
+        if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            LOG_ERROR("RENDER", "render_targets_init '%s': resolve frame buffer creation failed!", name);
+            state = false;
+        }
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    //Incomplete targets are released again so that the caller only has to handle the returned status
+    if(state == false)
+        render_targets_deinit(targets);
+    return state;
+}
+
+void render_targets_render_begin(Render_Targets* targets)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, targets->frame_buff);
+    glViewport(0, 0, targets->width, targets->height);
+}
+
+void render_targets_render_end(Render_Targets* targets)
+{
+    (void) targets;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//Resolves every attachment that has a resolved texture. Only the given region is resolved
+// or everything if width or height is 0. Does nothing when not multisampled or nothing is resolved.
+void render_targets_resolve(Render_Targets* targets, i32 x, i32 y, i32 width, i32 height)
+{
+    if(targets->sample_count <= 1 || targets->resolve_frame_buff == 0)
+        return;
+
+    if(width <= 0 || height <= 0)
+    {
+        x = 0; y = 0;
+        width = targets->width;
+        height = targets->height;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, targets->frame_buff);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, targets->resolve_frame_buff);
+    for(i32 i = 0; i < targets->attachment_count; i++)
+    {
+        if(targets->attachments[i].resolved_texture == 0)
+            continue;
+
+        GLenum draw_buffers[RENDER_TARGETS_MAX_ATTACHMENTS] = {0};
+        draw_buffers[i] = GL_COLOR_ATTACHMENT0 + (GLenum) i;
+        glReadBuffer(GL_COLOR_ATTACHMENT0 + (GLenum) i);
+        glDrawBuffers(i + 1, draw_buffers);
+        glBlitFramebuffer(x, y, x + width, y + height, x, y, x + width, y + height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    }
+
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//Returns the texture of the attachment that can be sampled with a regular sampler2D
+// (the resolved one when multisampled) or 0 if there is none.
+GLuint render_targets_texture(const Render_Targets* targets, i32 attachment)
+{
+    ASSERT(0 <= attachment && attachment < targets->attachment_count);
+    const Render_Target_Attachment* at = &targets->attachments[attachment];
+    return targets->sample_count > 1 ? at->resolved_texture : at->texture;
+}
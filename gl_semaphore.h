@@ -0,0 +1,87 @@
+#pragma once
+
+//Counting semaphore so that worker threads (gl_virtual_texture, gl_worker) can sleep until there is
+// work for them instead of polling. Every post lets exactly one wait through, posts made while no one
+// is waiting are remembered so wakeups are never lost.
+
+#include "gl.h"
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+
+    typedef struct GL_Semaphore {
+        HANDLE handle;
+    } GL_Semaphore;
+#else
+    #include <pthread.h>
+
+    typedef struct GL_Semaphore {
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        i64 count;
+    } GL_Semaphore;
+#endif
+
+#if defined(_WIN32)
+void gl_semaphore_init(GL_Semaphore* semaphore)
+{
+    semaphore->handle = CreateSemaphoreA(NULL, 0, 0x7FFFFFFF, NULL);
+}
+
+void gl_semaphore_deinit(GL_Semaphore* semaphore)
+{
+    CloseHandle(semaphore->handle);
+    memset(semaphore, 0, sizeof *semaphore);
+}
+
+void gl_semaphore_post(GL_Semaphore* semaphore, i32 count)
+{
+    if(count > 0)
+        ReleaseSemaphore(semaphore->handle, count, NULL);
+}
+
+void gl_semaphore_wait(GL_Semaphore* semaphore)
+{
+    WaitForSingleObject(semaphore->handle, INFINITE);
+}
+#else
+void gl_semaphore_init(GL_Semaphore* semaphore)
+{
+    pthread_mutex_init(&semaphore->mutex, NULL);
+    pthread_cond_init(&semaphore->cond, NULL);
+    semaphore->count = 0;
+}
+
+void gl_semaphore_deinit(GL_Semaphore* semaphore)
+{
+    pthread_cond_destroy(&semaphore->cond);
+    pthread_mutex_destroy(&semaphore->mutex);
+    memset(semaphore, 0, sizeof *semaphore);
+}
+
+void gl_semaphore_post(GL_Semaphore* semaphore, i32 count)
+{
+    if(count <= 0)
+        return;
+
+    pthread_mutex_lock(&semaphore->mutex);
+    semaphore->count += count;
+    if(count == 1)
+        pthread_cond_signal(&semaphore->cond);
+    else
+        pthread_cond_broadcast(&semaphore->cond);
+    pthread_mutex_unlock(&semaphore->mutex);
+}
+
+void gl_semaphore_wait(GL_Semaphore* semaphore)
+{
+    pthread_mutex_lock(&semaphore->mutex);
+    while(semaphore->count <= 0)
+        pthread_cond_wait(&semaphore->cond, &semaphore->mutex);
+    semaphore->count -= 1;
+    pthread_mutex_unlock(&semaphore->mutex);
+}
+#endif
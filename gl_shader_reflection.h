@@ -0,0 +1,402 @@
+#pragma once
+
+//Reflection of uniform and shader storage blocks of linked programs (requires GL 4.3 program interface queries).
+//
+//shader_reflection_emit_c generates C structs matching the exact layout the driver chose for each block
+// (std140/std430/shared) including explicit padding and static offset asserts. Compile the generated header
+// into the application and a whole block can then be set with a single memcpy + shader_block_buffer_upload
+// instead of many string keyed render_shader_set_* calls. When the shader changes the asserts catch layout
+// mismatches at compile time, shader_reflection_check_block catches them at runtime.
+//Arrays of structs are flattened into one member per reported element member (ie. lights_0_color, lights_1_color).
+//Top level arrays of structs in storage blocks are only reported for the first element by GL and get emitted as such.
+//Arrays of blocks (ie. uniform Light {...} lights[4]) are reported per element ("Light[0]", "Light[1]") and get a single
+// struct "Light" whose _BINDING is the binding of the first element (the others follow consecutively).
+
+#include "gl.h"
+#include "gl_shader_util.h"
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct Shader_Block_Member {
+    char name[64];
+    GLenum type;        //GL_FLOAT, GL_FLOAT_VEC3, GL_FLOAT_MAT4, ...
+    i32 offset;
+    i32 array_size;     //1 for non arrays, 0 for runtime sized arrays (last member of storage blocks)
+    i32 array_stride;
+    i32 matrix_stride;
+    bool row_major;
+} Shader_Block_Member;
+
+typedef Array(Shader_Block_Member) Shader_Block_Member_Array;
+
+typedef struct Shader_Block {
+    char name[64];
+    GLenum interface;   //GL_UNIFORM_BLOCK or GL_SHADER_STORAGE_BLOCK
+    i32 index;
+    i32 binding;
+    i32 data_size;
+    Shader_Block_Member_Array members; //sorted by offset
+} Shader_Block;
+
+typedef Array(Shader_Block) Shader_Block_Array;
+
+typedef struct Shader_Reflection {
+    GLuint program;
+    Shader_Block_Array blocks;
+} Shader_Reflection;
+
+void shader_reflection_deinit(Shader_Reflection* reflection)
+{
+    for(isize i = 0; i < reflection->blocks.len; i++)
+        array_deinit(&reflection->blocks.data[i].members);
+    array_deinit(&reflection->blocks);
+    memset(reflection, 0, sizeof *reflection);
+}
+
+INTERNAL int _shader_block_member_compare(const void* a, const void* b)
+{
+    i32 offset_a = ((const Shader_Block_Member*) a)->offset;
+    i32 offset_b = ((const Shader_Block_Member*) b)->offset;
+    return (offset_a > offset_b) - (offset_a < offset_b);
+}
+
+INTERNAL void _shader_reflect_interface(Shader_Reflection* reflection, Allocator* alloc, GLenum interface)
+{
+    GLuint program = reflection->program;
+    GLenum variable_interface = interface == GL_UNIFORM_BLOCK ? GL_UNIFORM : GL_BUFFER_VARIABLE;
+
+    GLint block_count = 0;
+    glGetProgramInterfaceiv(program, interface, GL_ACTIVE_RESOURCES, &block_count);
+    for(GLint b = 0; b < block_count; b++)
+    {
+        Shader_Block block = {0};
+        block.interface = interface;
+        block.index = b;
+        block.members.allocator = alloc;
+        glGetProgramResourceName(program, interface, (GLuint) b, sizeof block.name, NULL, block.name);
+
+        GLenum block_props[] = {GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE, GL_NUM_ACTIVE_VARIABLES};
+        GLint block_values[3] = {0};
+        glGetProgramResourceiv(program, interface, (GLuint) b, 3, block_props, 3, NULL, block_values);
+        block.binding = block_values[0];
+        block.data_size = block_values[1];
+
+        GLint variable_count = block_values[2];
+        SCRATCH_ARENA(arena)
+        {
+            Array(GLint) variables = {0};
+            variables.allocator = arena.alloc;
+            array_resize(&variables, variable_count);
+
+            GLenum active_variables = GL_ACTIVE_VARIABLES;
+            glGetProgramResourceiv(program, interface, (GLuint) b, 1, &active_variables, variable_count, NULL, variables.data);
+
+            for(GLint v = 0; v < variable_count; v++)
+            {
+                Shader_Block_Member member = {0};
+                glGetProgramResourceName(program, variable_interface, (GLuint) variables.data[v], sizeof member.name, NULL, member.name);
+
+                GLenum props[] = {GL_TYPE, GL_OFFSET, GL_ARRAY_SIZE, GL_ARRAY_STRIDE, GL_MATRIX_STRIDE, GL_IS_ROW_MAJOR};
+                GLint values[6] = {0};
+                glGetProgramResourceiv(program, variable_interface, (GLuint) variables.data[v], 6, props, 6, NULL, values);
+                member.type = (GLenum) values[0];
+                member.offset = values[1];
+                member.array_size = values[2];
+                member.array_stride = values[3];
+                member.matrix_stride = values[4];
+                member.row_major = values[5] != 0;
+
+                array_push(&block.members, member);
+            }
+        }
+
+        qsort(block.members.data, (size_t) block.members.len, sizeof *block.members.data, _shader_block_member_compare);
+        array_push(&reflection->blocks, block);
+    }
+}
+
+//Queries all uniform and shader storage blocks of the program.
+Shader_Reflection shader_reflect(Allocator* alloc, GLuint program)
+{
+    Shader_Reflection reflection = {0};
+    reflection.program = program;
+    reflection.blocks.allocator = alloc;
+
+    _shader_reflect_interface(&reflection, alloc, GL_UNIFORM_BLOCK);
+    _shader_reflect_interface(&reflection, alloc, GL_SHADER_STORAGE_BLOCK);
+    return reflection;
+}
+
+const Shader_Block* shader_reflection_find_block(const Shader_Reflection* reflection, const char* name)
+{
+    for(isize i = 0; i < reflection->blocks.len; i++)
+        if(strcmp(reflection->blocks.data[i].name, name) == 0)
+            return &reflection->blocks.data[i];
+
+    return NULL;
+}
+
+//Describes a glsl type in terms of C scalars. Returns false for types that cannot live inside blocks.
+INTERNAL bool _shader_type_layout(GLenum type, const char** scalar, i32* columns, i32* rows)
+{
+    *columns = 1;
+    switch(type)
+    {
+        case GL_FLOAT:              *scalar = "f32"; *rows = 1; return true;
+        case GL_FLOAT_VEC2:         *scalar = "f32"; *rows = 2; return true;
+        case GL_FLOAT_VEC3:         *scalar = "f32"; *rows = 3; return true;
+        case GL_FLOAT_VEC4:         *scalar = "f32"; *rows = 4; return true;
+        case GL_DOUBLE:             *scalar = "f64"; *rows = 1; return true;
+        case GL_DOUBLE_VEC2:        *scalar = "f64"; *rows = 2; return true;
+        case GL_DOUBLE_VEC3:        *scalar = "f64"; *rows = 3; return true;
+        case GL_DOUBLE_VEC4:        *scalar = "f64"; *rows = 4; return true;
+        case GL_INT:                *scalar = "i32"; *rows = 1; return true;
+        case GL_INT_VEC2:           *scalar = "i32"; *rows = 2; return true;
+        case GL_INT_VEC3:           *scalar = "i32"; *rows = 3; return true;
+        case GL_INT_VEC4:           *scalar = "i32"; *rows = 4; return true;
+        case GL_UNSIGNED_INT:       *scalar = "u32"; *rows = 1; return true;
+        case GL_UNSIGNED_INT_VEC2:  *scalar = "u32"; *rows = 2; return true;
+        case GL_UNSIGNED_INT_VEC3:  *scalar = "u32"; *rows = 3; return true;
+        case GL_UNSIGNED_INT_VEC4:  *scalar = "u32"; *rows = 4; return true;
+        //glsl bools are 4 bytes inside blocks
+        case GL_BOOL:               *scalar = "u32"; *rows = 1; return true;
+        case GL_BOOL_VEC2:          *scalar = "u32"; *rows = 2; return true;
+        case GL_BOOL_VEC3:          *scalar = "u32"; *rows = 3; return true;
+        case GL_BOOL_VEC4:          *scalar = "u32"; *rows = 4; return true;
+        case GL_FLOAT_MAT2:         *scalar = "f32"; *columns = 2; *rows = 2; return true;
+        case GL_FLOAT_MAT3:         *scalar = "f32"; *columns = 3; *rows = 3; return true;
+        case GL_FLOAT_MAT4:         *scalar = "f32"; *columns = 4; *rows = 4; return true;
+        case GL_FLOAT_MAT2x3:       *scalar = "f32"; *columns = 2; *rows = 3; return true;
+        case GL_FLOAT_MAT2x4:       *scalar = "f32"; *columns = 2; *rows = 4; return true;
+        case GL_FLOAT_MAT3x2:       *scalar = "f32"; *columns = 3; *rows = 2; return true;
+        case GL_FLOAT_MAT3x4:       *scalar = "f32"; *columns = 3; *rows = 4; return true;
+        case GL_FLOAT_MAT4x2:       *scalar = "f32"; *columns = 4; *rows = 2; return true;
+        case GL_FLOAT_MAT4x3:       *scalar = "f32"; *columns = 4; *rows = 3; return true;
+        default:                    *scalar = NULL; *rows = 0; return false;
+    }
+}
+
+//Copies name[0, len) into into as a valid C identifier: '.' and '[' become '_', ']' is dropped 
+// and any other character that cannot be in an identifier becomes '_'.
+INTERNAL void _shader_c_identifier(char* into, isize into_size, const char* name, size_t len)
+{
+    isize written = 0;
+    for(size_t i = 0; i < len && written < into_size - 1; i++)
+    {
+        char c = name[i];
+        if(c == ']')
+            continue;
+
+        bool is_valid = ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9') || c == '_';
+        into[written++] = is_valid ? c : '_';
+    }
+    into[written] = '\0';
+}
+
+//Returns the length of the block name without the array index of block arrays ("Light[2]" -> "Light")
+INTERNAL size_t _shader_block_base_name_len(const char* block_name)
+{
+    const char* bracket = strchr(block_name, '[');
+    return bracket ? (size_t) (bracket - block_name) : strlen(block_name);
+}
+
+INTERNAL void _shader_block_c_name(char* into, isize into_size, const char* block_name)
+{
+    _shader_c_identifier(into, into_size, block_name, _shader_block_base_name_len(block_name));
+}
+
+//Turns names like "Instance.lights[0].color" into valid C identifiers "lights_0_color". Drops the trailing [0] of arrays.
+INTERNAL void _shader_member_c_name(char* into, isize into_size, const char* block_name, const char* member_name)
+{
+    //Members of blocks with an instance name are reported as "Block.member" (without the index for block arrays)
+    size_t block_len = _shader_block_base_name_len(block_name);
+    if(strncmp(member_name, block_name, block_len) == 0 && member_name[block_len] == '.')
+        member_name += block_len + 1;
+
+    size_t len = strlen(member_name);
+    if(len >= 3 && strcmp(member_name + len - 3, "[0]") == 0)
+        len -= 3;
+
+    _shader_c_identifier(into, into_size, member_name, len);
+}
+
+//Appends C declarations of all blocks in the reflection to into. Each block becomes a struct named
+// <prefix><Block_Name> with members placed at exactly the offsets reported by the driver.
+void shader_reflection_emit_c(String_Builder* into, const Shader_Reflection* reflection, const char* prefix)
+{
+    for(isize b = 0; b < reflection->blocks.len; b++)
+    {
+        const Shader_Block* block = &reflection->blocks.data[b];
+        char block_name[64] = {0};
+        _shader_block_c_name(block_name, sizeof block_name, block->name);
+
+        //Elements of block arrays share the layout so only the first one is emitted
+        i32 array_count = 1;
+        i32 binding = block->binding;
+        bool was_emitted = false;
+        for(isize other = 0; other < reflection->blocks.len; other++)
+        {
+            const Shader_Block* other_block = &reflection->blocks.data[other];
+            char other_name[64] = {0};
+            _shader_block_c_name(other_name, sizeof other_name, other_block->name);
+            if(other != b && other_block->interface == block->interface && strcmp(other_name, block_name) == 0)
+            {
+                array_count += 1;
+                binding = MIN(binding, other_block->binding);
+                was_emitted = was_emitted || other < b;
+            }
+        }
+
+        if(was_emitted)
+            continue;
+
+        const char* kind = block->interface == GL_UNIFORM_BLOCK ? "uniform" : "buffer";
+        if(array_count > 1)
+            format_append_into(into, "\n//%s block array '%s' of %i blocks binding %i size %i\n", kind, block_name, (int) array_count, (int) binding, (int) block->data_size);
+        else
+            format_append_into(into, "\n//%s block '%s' binding %i size %i\n", kind, block_name, (int) block->binding, (int) block->data_size);
+        format_append_into(into, "typedef struct %s%s {\n", prefix, block_name);
+
+        i32 at = 0;
+        i32 padding_count = 0;
+        bool has_runtime_array = false;
+        for(isize m = 0; m < block->members.len; m++)
+        {
+            const Shader_Block_Member* member = &block->members.data[m];
+            char name[64] = {0};
+            _shader_member_c_name(name, sizeof name, block->name, member->name);
+
+            const char* scalar = NULL;
+            i32 columns = 0, rows = 0;
+            if(_shader_type_layout(member->type, &scalar, &columns, &rows) == false)
+            {
+                format_append_into(into, "    //skipped '%s' of unsupported type 0x%x\n", member->name, (unsigned) member->type);
+                continue;
+            }
+
+            if(member->offset > at)
+                format_append_into(into, "    u8 _padding%i[%i];\n", (int) padding_count++, (int) (member->offset - at));
+
+            //Matrices are arrays of columns (or rows when row major) matrix_stride bytes apart
+            i32 scalar_size = strcmp(scalar, "f64") == 0 ? 8 : 4;
+            i32 vectors = columns;
+            i32 vector_len = rows;
+            if(columns > 1 && member->row_major)
+            {
+                vectors = rows;
+                vector_len = columns;
+            }
+
+            //The dimensions of a single element which go after the name (and the array count)
+            i32 element_size = 0;
+            char dimensions[32] = "";
+            if(columns > 1)
+            {
+                i32 stride_scalars = member->matrix_stride / scalar_size;
+                snprintf(dimensions, sizeof dimensions, "[%i][%i]", (int) vectors, (int) stride_scalars);
+                element_size = vectors * member->matrix_stride;
+            }
+            else
+            {
+                if(vector_len > 1)
+                    snprintf(dimensions, sizeof dimensions, "[%i]", (int) vector_len);
+                element_size = vector_len * scalar_size;
+            }
+
+            bool is_array = member->array_size != 1;
+            char count[32] = "";
+            if(member->array_size == 0)
+            {
+                has_runtime_array = true;
+                snprintf(count, sizeof count, "[]");
+            }
+            else if(is_array)
+                snprintf(count, sizeof count, "[%i]", (int) member->array_size);
+
+            //Arrays whose stride is bigger than the element (ie. std140 float[]) need every element padded
+            if(is_array && member->array_stride > element_size)
+                format_append_into(into, "    struct {%s value%s; u8 _padding[%i];} %s%s;\n", 
+                    scalar, dimensions, (int) (member->array_stride - element_size), name, count);
+            else
+                format_append_into(into, "    %s %s%s%s;\n", scalar, name, count, dimensions);
+
+            at = member->offset + (is_array ? member->array_stride * member->array_size : element_size);
+        }
+
+        if(has_runtime_array == false && block->data_size > at)
+            format_append_into(into, "    u8 _padding%i[%i];\n", (int) padding_count++, (int) (block->data_size - at));
+
+        format_append_into(into, "} %s%s;\n\n", prefix, block_name);
+
+        for(isize m = 0; m < block->members.len; m++)
+        {
+            const Shader_Block_Member* member = &block->members.data[m];
+            const char* scalar = NULL;
+            i32 columns = 0, rows = 0;
+            if(_shader_type_layout(member->type, &scalar, &columns, &rows) == false)
+                continue;
+
+            char name[64] = {0};
+            _shader_member_c_name(name, sizeof name, block->name, member->name);
+            format_append_into(into, "STATIC_ASSERT(offsetof(%s%s, %s) == %i);\n", prefix, block_name, name, (int) member->offset);
+        }
+
+        if(has_runtime_array == false)
+            format_append_into(into, "STATIC_ASSERT(sizeof(%s%s) == %i);\n", prefix, block_name, (int) block->data_size);
+        format_append_into(into, "#define %s%s_BINDING %i\n", prefix, block_name, (int) binding);
+    }
+}
+
+//Checks that the C struct used for the block has the size the driver expects.
+//Returns false and logs if it does not or if the block does not exist.
+bool shader_reflection_check_block(const Shader_Reflection* reflection, const char* block_name, isize c_struct_size)
+{
+    const Shader_Block* block = shader_reflection_find_block(reflection, block_name);
+    if(block == NULL)
+    {
+        LOG_ERROR("SHADER", "Block '%s' not found in program %u", block_name, reflection->program);
+        return false;
+    }
+
+    if(block->data_size != c_struct_size)
+    {
+        LOG_ERROR("SHADER", "Block '%s' layout mismatch: shader expects %i bytes but the C struct has %lli. Regenerate the block structs.",
+            block_name, (int) block->data_size, (long long) c_struct_size);
+        return false;
+    }
+
+    return true;
+}
+
+//A buffer backing one uniform or storage block.
+typedef struct Shader_Block_Buffer {
+    GLuint buffer;
+    GLenum target; //GL_UNIFORM_BUFFER or GL_SHADER_STORAGE_BUFFER
+    isize size;
+} Shader_Block_Buffer;
+
+void shader_block_buffer_deinit(Shader_Block_Buffer* buffer)
+{
+    glDeleteBuffers(1, &buffer->buffer);
+    memset(buffer, 0, sizeof *buffer);
+}
+
+void shader_block_buffer_init(Shader_Block_Buffer* buffer, GLenum target, isize size)
+{
+    shader_block_buffer_deinit(buffer);
+    buffer->target = target;
+    buffer->size = size;
+    glGenBuffers(1, &buffer->buffer);
+    glBindBuffer(target, buffer->buffer);
+    glBufferData(target, (GLsizeiptr) size, NULL, GL_DYNAMIC_DRAW);
+    glBindBuffer(target, 0);
+}
+
+//Uploads the whole block (usually a generated struct) and binds it to the binding point.
+void shader_block_buffer_upload(Shader_Block_Buffer* buffer, GLuint binding, const void* data, isize size)
+{
+    ASSERT(size <= buffer->size);
+    glBindBuffer(buffer->target, buffer->buffer);
+    glBufferSubData(buffer->target, 0, (GLsizeiptr) size, data);
+    glBindBufferBase(buffer->target, binding, buffer->buffer);
+}
@@ -2,6 +2,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "gl.h"
+#include "gl_context_state.h"
+#include "gl_semaphore.h"
 
 typedef enum {
     SHADER_TYPE_RENDER,
@@ -16,6 +18,9 @@ typedef struct GL_Shader {
     int32_t block_size_size_x;
     int32_t block_size_size_y;
     int32_t block_size_size_z;
+
+    //location + 1 of u_dispatch_group_offset or 0 when the kernel does not use DISPATCH_GROUP_ID
+    int32_t group_offset_location;
 } GL_Shader;
 
 enum {MAX_SHADER_STAGES = 7};
@@ -140,66 +145,105 @@ GLuint shader_compile_compute(const char* source, Shader_Errors* errors_or_null)
     return shader_compile(&source, &shader_type, 1, errors_or_null);
 }
 
-typedef struct Compute_Shader_Limits {
-    int32_t max_group_invocations;
-    int32_t max_group_count[3];
-    int32_t max_group_size[3];
-} Compute_Shader_Limits;
-
+//Limits of the current context. Queried once per context (see gl_context_state.h).
 Compute_Shader_Limits compute_shader_query_limits()
 {
-    static Compute_Shader_Limits querried = {-1};
-    if(querried.max_group_invocations < 0)
+    GL_Context_State* context_state = gl_context_state();
+    Compute_Shader_Limits* querried = &context_state->compute_limits;
+    if(context_state->has_compute_limits == false)
     {
         STATIC_ASSERT(sizeof(GLint) == sizeof(int32_t));
 	    for (GLuint i = 0; i < 3; i++) 
         {
-		    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &querried.max_group_count[i]);
-		    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, i, &querried.max_group_size[i]);
+		    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_COUNT, i, &querried->max_group_count[i]);
+		    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, i, &querried->max_group_size[i]);
 
-            querried.max_group_size[i] = MAX(querried.max_group_size[i], 1);
-            querried.max_group_count[i] = MAX(querried.max_group_count[i], 1);
+            querried->max_group_size[i] = MAX(querried->max_group_size[i], 1);
+            querried->max_group_count[i] = MAX(querried->max_group_count[i], 1);
 	    }	
-	    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &querried.max_group_invocations);
+	    glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &querried->max_group_invocations);
 
-        querried.max_group_invocations = MAX(querried.max_group_invocations, 1);
+        querried->max_group_invocations = MAX(querried->max_group_invocations, 1);
+        context_state->has_compute_limits = true;
     }
 
-    return querried;
+    return *querried;
 }
 
-static const GL_Shader* current_used_shader = NULL;
-static GLuint current_used_shader_handle = 0;
+//The used program is tracked per context so that redundant glUseProgram calls are skipped.
 void render_shader_use(const GL_Shader* shader)
 {
     ASSERT(shader->handle != 0);
-    if(shader->handle != current_used_shader_handle)
+    GL_Context_State* context_state = gl_context_state();
+    if(shader->handle != context_state->used_shader_handle)
     {
         glUseProgram(shader->handle);
-        current_used_shader = shader;
-        current_used_shader_handle = shader->handle;
+        context_state->used_shader = shader;
+        context_state->used_shader_handle = shader->handle;
     }
 }
 
 void render_shader_unuse(const GL_Shader* shader)
 {
     ASSERT(shader->handle != 0);
-    if(current_used_shader_handle != 0)
+    GL_Context_State* context_state = gl_context_state();
+    if(context_state->used_shader_handle != 0)
     {
         glUseProgram(0);
-        current_used_shader = NULL;
-        current_used_shader_handle = 0;
+        context_state->used_shader = NULL;
+        context_state->used_shader_handle = 0;
     }
 }
 
-void compute_shader_dispatch(GL_Shader* compute_shader, isize size_x, isize size_y, isize size_z)
+//Dispatches num_groups workgroups of the compute program currently in use. When more workgroups are needed than
+// GL_MAX_COMPUTE_WORK_GROUP_COUNT allows the dispatch is split into several, each with u_dispatch_group_offset set
+// to its first workgroup. This only works for kernels which use DISPATCH_GROUP_ID / DISPATCH_GLOBAL_ID
+// (see compute_shader_init_from_disk_with_defines) instead of gl_WorkGroupID / gl_GlobalInvocationID,
+// for others it fails with an error. Splitting also makes gl_NumWorkGroups the size of the part.
+bool compute_shader_dispatch_groups(const char* name, i32 group_offset_location, const isize num_groups[3])
 {
-    GLuint num_groups_x = (GLuint) MAX(DIV_CEIL(size_x, compute_shader->block_size_size_x), 1);
-    GLuint num_groups_y = (GLuint) MAX(DIV_CEIL(size_y, compute_shader->block_size_size_y), 1);
-    GLuint num_groups_z = (GLuint) MAX(DIV_CEIL(size_z, compute_shader->block_size_size_z), 1);
+    Compute_Shader_Limits limits = compute_shader_query_limits();
+    if(num_groups[0] <= limits.max_group_count[0] && num_groups[1] <= limits.max_group_count[1] && num_groups[2] <= limits.max_group_count[2])
+    {
+	    glDispatchCompute((GLuint) num_groups[0], (GLuint) num_groups[1], (GLuint) num_groups[2]);
+        return true;
+    }
+
+    if(group_offset_location == 0 || num_groups[0] > UINT32_MAX || num_groups[1] > UINT32_MAX || num_groups[2] > UINT32_MAX)
+    {
+        LOG_ERROR("SHADER", "compute_shader_dispatch: '%s' needs %lli x %lli x %lli workgroups (max %i x %i x %i) and cannot be split since it does not use DISPATCH_GROUP_ID", 
+            name, (long long) num_groups[0], (long long) num_groups[1], (long long) num_groups[2], 
+            limits.max_group_count[0], limits.max_group_count[1], limits.max_group_count[2]);
+        return false;
+    }
+
+    GLint location = group_offset_location - 1;
+    for(isize z = 0; z < num_groups[2]; z += limits.max_group_count[2])
+        for(isize y = 0; y < num_groups[1]; y += limits.max_group_count[1])
+            for(isize x = 0; x < num_groups[0]; x += limits.max_group_count[0])
+            {
+                glUniform3ui(location, (GLuint) x, (GLuint) y, (GLuint) z);
+                glDispatchCompute(
+                    (GLuint) MIN(num_groups[0] - x, limits.max_group_count[0]), 
+                    (GLuint) MIN(num_groups[1] - y, limits.max_group_count[1]), 
+                    (GLuint) MIN(num_groups[2] - z, limits.max_group_count[2]));
+            }
+
+    glUniform3ui(location, 0, 0, 0);
+    return true;
+}
+
+//Dispatches enough workgroups to cover size_x x size_y x size_z invocations splitting if needed (see above).
+bool compute_shader_dispatch(GL_Shader* compute_shader, isize size_x, isize size_y, isize size_z)
+{
+    isize num_groups[3] = {
+        MAX(DIV_CEIL(size_x, compute_shader->block_size_size_x), 1),
+        MAX(DIV_CEIL(size_y, compute_shader->block_size_size_y), 1),
+        MAX(DIV_CEIL(size_z, compute_shader->block_size_size_z), 1),
+    };
 
     render_shader_use(compute_shader);
-	glDispatchCompute(num_groups_x, num_groups_y, num_groups_z);
+    return compute_shader_dispatch_groups(compute_shader->name, compute_shader->group_offset_location, num_groups);
 }
 
 bool render_shader_set_i32(GL_Shader* shader, const char* name, i32 val)
@@ -266,6 +310,7 @@ bool render_shader_set_mat4(GL_Shader* shader, const char* name, Mat4 val)
 #include "../lib/hash.h"
 #include "../lib/parse.h"
 #include "../lib/path.h"
+#include "../lib/platform.h"
 
 typedef struct Shader_File_Cache_Entry{
     String_Builder contents;
@@ -319,6 +364,123 @@ void _source_preprocess_log(_Shader_File_Recursion* recursion, const char* forma
     }
 }
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define _SHADER_SCAN_SSE2
+#endif
+
+//Returns the index of the first c in data[from, to) or to if there is none. 
+isize _shader_scan_find_char(const char* data, isize from, isize to, char c)
+{
+    isize i = from;
+    #ifdef _SHADER_SCAN_SSE2
+    __m128i pattern = _mm_set1_epi8(c);
+    for(; i + 16 <= to; i += 16)
+    {
+        __m128i chunk = _mm_loadu_si128((const __m128i*) (void*) (data + i));
+        u32 mask = (u32) _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, pattern));
+        if(mask != 0)
+        {
+            #ifdef _MSC_VER
+            unsigned long first = 0;
+            _BitScanForward(&first, mask);
+            return i + (isize) first;
+            #else
+            return i + __builtin_ctz(mask);
+            #endif
+        }
+    }
+    #else
+    if(from < to)
+    {
+        const char* found = (const char*) memchr(data + from, c, (size_t) (to - from));
+        return found ? (isize) (found - data) : to;
+    }
+    #endif
+
+    for(; i < to; i++)
+        if(data[i] == c)
+            return i;
+
+    return to;
+}
+
+//Returns the number of occurences of c in data[from, to). 
+isize _shader_scan_count_char(const char* data, isize from, isize to, char c)
+{
+    isize count = 0;
+    isize i = from;
+    #ifdef _SHADER_SCAN_SSE2
+    __m128i pattern = _mm_set1_epi8(c);
+    while(i + 16 <= to)
+    {
+        //A match compares as 0xFF (-1) so subtracting it counts the byte lane up by one. At most 255 iterations 
+        // fit into a lane before it would wrap so every so often the lanes are summed up into count.
+        __m128i lanes = _mm_setzero_si128();
+        for(isize iters = 0; iters < 255 && i + 16 <= to; iters++, i += 16)
+        {
+            __m128i chunk = _mm_loadu_si128((const __m128i*) (void*) (data + i));
+            lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(chunk, pattern));
+        }
+
+        __m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+        count += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+    }
+    #endif
+
+    for(; i < to; i++)
+        count += data[i] == c;
+
+    return count;
+}
+
+//Finds the next line containing '#' starting from the line beginning at *scan_from. 
+//Fills the line range [line_from, line_to) (without the '\n') and the position of the first '#' in it
+// and moves *scan_from to the start of the following line. Returns false if there are no more such lines.
+bool _shader_source_next_hash_line(String source, isize* scan_from, isize* line_from, isize* hash_i, isize* line_to)
+{
+    if(*scan_from >= source.len)
+        return false;
+
+    isize hash = _shader_scan_find_char(source.data, *scan_from, source.len, '#');
+    if(hash == source.len)
+    {
+        *scan_from = source.len;
+        return false;
+    }
+
+    isize from = hash;
+    while(from > *scan_from && source.data[from - 1] != '\n')
+        from -= 1;
+
+    *line_from = from;
+    *hash_i = hash;
+    *line_to = _shader_scan_find_char(source.data, hash, source.len, '\n');
+    *scan_from = *line_to + 1;
+    return true;
+}
+
+i32 _shader_file_cache_find(Shader_File_Cache* cache, Path full_path)
+{
+    for(isize i = 0; i < cache->len; i++)
+        if(path_is_equal_except_prefix(full_path, cache->data[i].full_path.path))
+            return (i32) i;
+
+    return -1;
+}
+
+i32 _shader_file_cache_add(Shader_File_Cache* cache, Path_Builder full_path)
+{
+    Shader_File_Cache_Entry new_entry = {0};
+    new_entry.full_path = path_builder_dup(cache->allocator, full_path);
+    new_entry.contents = builder_make(cache->allocator, 0);
+    new_entry.processed = builder_make(cache->allocator, 0);
+    new_entry.okay = true;
+
+    array_push(cache, new_entry);
+    return (i32) cache->len - 1;
+}
+
 #include "../lib/parse.h"
 i32 _shader_file_load_into_cache_and_handle_inclusion_recursion(Shader_File_Cache* cache, _Shader_File_Recursion* recursion, Path current_dir, Path path)
 {
@@ -382,15 +544,7 @@ i32 _shader_file_load_into_cache_and_handle_inclusion_recursion(Shader_File_Cach
             //If not found add it
             if(result == -1)
             {
-                Shader_File_Cache_Entry new_entry = {0};
-                new_entry.full_path = path_builder_dup(cache->allocator, full_path);
-                new_entry.contents = builder_make(cache->allocator, 0);
-                new_entry.processed = builder_make(cache->allocator, 0);
-                new_entry.okay = true;
-
-                result = (i32) cache->len;
-                array_push(cache, new_entry);
-                
+                result = _shader_file_cache_add(cache, full_path);
                 LOG_DEBUG("SHADER", "Found new shader file '%s'",  display_path.data);
             }
 
@@ -418,32 +572,44 @@ i32 _shader_file_load_into_cache_and_handle_inclusion_recursion(Shader_File_Cach
 
                 builder_clear(&entry->processed);
                 builder_reserve(&entry->processed, source.len + 256);
-                for(Line_Iterator it = {0}; line_iterator_get_line(&it, source); )
+
+                //Only lines containing '#' are ever looked at. Everything in between 
+                // is copied into processed as a single block.
+                isize copied_to = 0;
+                isize counted_to = 0;
+                isize line_number = 1;
+                isize scan_from = 0;
+                isize line_from = 0, hash_i = 0, line_to = 0;
+                while(_shader_source_next_hash_line(source, &scan_from, &line_from, &hash_i, &line_to))
                 {
-                    String line = it.line;
-                    isize hash_i    = string_find_first(line, STRING("#"), 0);
-                    isize version_i = hash_i + 1;
-                    isize include_i = hash_i + 1;
-                    if(hash_i != -1)
-                    {
-                        match_whitespace(line, &version_i);
-                        version_i = include_i;
-                    }
+                    String line = string_safe_range(source, line_from, line_to);
+                    isize version_i = hash_i - line_from + 1;
+                    isize include_i = hash_i - line_from + 1;
+
+                    bool is_version = match_sequence(line, &version_i, STRING("version"));
+                    bool is_include = is_version == false && match_sequence(line, &include_i, STRING("include"));
+                    if(is_version == false && is_include == false)
+                        continue;
+
+                    builder_append(&entry->processed, string_safe_range(source, copied_to, line_from));
+                    copied_to = MIN(line_to + 1, source.len);
+                    line_number += _shader_scan_count_char(source.data, counted_to, line_from, '\n');
+                    counted_to = line_from;
 
-                    if(hash_i != -1 && match_sequence(line, &version_i, STRING("version")))
+                    if(is_version)
                     {
                         if(entry->has_version)
-                            _source_preprocess_log(recursion, "Error: duplicate version string on line %i. Ignoring.", (int)it.line_number);
+                            _source_preprocess_log(recursion, "Error: duplicate version string on line %i. Ignoring.", (int) line_number);
                         else
                         {
                             entry->has_version = true;
-                            entry->version_line = it.line_number;
+                            entry->version_line = line_number;
                             entry->version_offset = entry->processed.len;
                             builder_append_line(&entry->processed, line);
                             entry->version_after_offset = entry->processed.len;
                         }
                     }
-                    else if(hash_i != -1 && match_sequence(line, &include_i, STRING("include")))
+                    else
                     {
                         isize include_str_from = include_i;
                         match_whitespace(line, &include_str_from);
@@ -459,27 +625,32 @@ i32 _shader_file_load_into_cache_and_handle_inclusion_recursion(Shader_File_Cach
                         if(okay == false)
                         {
                             entry->okay = false;
-                            _source_preprocess_log(recursion, "Error: malformed include statement '%.*s' on line %i. Ignoring.", STRING_PRINT(line), (int)it.line_number);
+                            _source_preprocess_log(recursion, "Error: malformed include statement '%.*s' on line %i. Ignoring.", STRING_PRINT(line), (int) line_number);
                         }
                         else if(recursion->visited_paths.len > MAX_RECURSION)
                         {
                             entry->okay = false;
                             _source_preprocess_log(recursion, "Error: recursion level %i too deep while including file '%.*s' on line on line %i", 
-                                (int) recursion->visited_paths.len, STRING_PRINT(include_path.string), (int)it.line_number);
+                                (int) recursion->visited_paths.len, STRING_PRINT(include_path.string), (int) line_number);
                         }
                         else
                         {
                             i32 nested_result = _shader_file_load_into_cache_and_handle_inclusion_recursion(cache, recursion, full_path_directory, include_path);
                             Shader_File_Cache_Entry* nested_entry = &cache->data[nested_result];
 
+                            //the recursion might have grown the cache
+                            entry = &cache->data[result];
                             builder_append_line(&entry->processed, nested_entry->processed.string);
                             entry->okay = entry->okay && nested_entry->okay;
                         }
                     }
-                    else
-                    {
-                        builder_append_line(&entry->processed, line);
-                    }
+                }
+
+                if(copied_to < source.len)
+                {
+                    builder_append(&entry->processed, string_tail(source, copied_to));
+                    if(source.data[source.len - 1] != '\n')
+                        builder_append(&entry->processed, STRING("\n"));
                 }
 
                 entry->has_processed = true;
@@ -509,6 +680,206 @@ i32 shader_file_load_into_cache_and_handle_inclusion(Shader_File_Cache* cache, P
     return result;
 }
 
+typedef Array(String) _Shader_Include_Array;
+
+//Appends the path of every well formed #include "..." directive in source to includes. 
+//Only looks at the directives, does not resolve or load anything.
+void _shader_source_scan_includes(String source, _Shader_Include_Array* includes)
+{
+    isize scan_from = 0;
+    isize line_from = 0, hash_i = 0, line_to = 0;
+    while(_shader_source_next_hash_line(source, &scan_from, &line_from, &hash_i, &line_to))
+    {
+        String line = string_safe_range(source, line_from, line_to);
+        isize include_i = hash_i - line_from + 1;
+        if(match_sequence(line, &include_i, STRING("include")))
+        {
+            isize include_str_from = include_i;
+            match_whitespace(line, &include_str_from);
+            bool okay = match_char(line, &include_str_from, '"');
+                            
+            isize include_str_to = include_str_from;
+            okay = okay && match_any_of_custom(line, &include_str_to, STRING("\""), MATCH_INVERTED);
+            if(okay)
+                array_push(includes, string_safe_range(line, include_str_from, include_str_to));
+        }
+    }
+}
+
+typedef struct _Shader_File_Prefetch {
+    Path_Builder       full_path;
+    String_Builder     contents;
+    Platform_File_Info file_info;
+    Platform_Error     file_error;
+} _Shader_File_Prefetch;
+
+typedef Array(_Shader_File_Prefetch) _Shader_File_Prefetch_Array;
+
+//The current wave shared with the pool of prefetch threads. files and count are only changed
+// while no worker is inside a wave.
+typedef struct _Shader_File_Prefetch_Batch {
+    _Shader_File_Prefetch* files;
+    i32 count;
+    volatile i32 next;
+    volatile i32 should_stop;
+    GL_Semaphore wave_ready; //posted once per worker for every wave and once per worker to stop
+    GL_Semaphore wave_done;  //posted by a worker every time it ran out of files of the wave
+} _Shader_File_Prefetch_Batch;
+
+void _shader_file_prefetch_worker(void* context)
+{
+    _Shader_File_Prefetch_Batch* batch = (_Shader_File_Prefetch_Batch*) context;
+    for(;;)
+    {
+        i32 i = platform_atomic_add32(&batch->next, 1);
+        if(i >= batch->count)
+            break;
+
+        _Shader_File_Prefetch* file = &batch->files[i];
+        file->file_error = file_read_entire(file->full_path.string, &file->contents, &file->file_info);
+    }
+}
+
+INTERNAL void _shader_file_prefetch_thread(void* context)
+{
+    _Shader_File_Prefetch_Batch* batch = (_Shader_File_Prefetch_Batch*) context;
+    for(;;)
+    {
+        gl_semaphore_wait(&batch->wave_ready);
+        if(platform_atomic_load32(&batch->should_stop))
+            break;
+
+        _shader_file_prefetch_worker(batch);
+        gl_semaphore_post(&batch->wave_done, 1);
+    }
+}
+
+//Same as shader_file_load_into_cache_and_handle_inclusion but first reads the whole include tree 
+// concurrently on up to thread_count threads. The files are loaded wave by wave (all includes of 
+// the previous wave at once) and only then assembled on the calling thread in the usual depth 
+// first order, so the result and all reported errors are identical to the serial version.
+//The threads are started once (and only as many as the widest wave can use) and are fed every wave.
+//Files that fail to read are left untouched and get read (and reported) again during assembly.
+i32 shader_file_load_into_cache_and_handle_inclusion_parallel(Shader_File_Cache* cache, Path current_dir, Path path, isize thread_count)
+{
+    enum {MAX_PREFETCH_THREADS = 64};
+    thread_count = MAX(MIN(thread_count, MAX_PREFETCH_THREADS), 1);
+
+    i32 result = 0;
+    _Shader_File_Prefetch_Batch batch = {0};
+    gl_semaphore_init(&batch.wave_ready);
+    gl_semaphore_init(&batch.wave_done);
+    Platform_Thread threads[MAX_PREFETCH_THREADS] = {0};
+    isize launched = 0;
+
+    SCRATCH_ARENA(arena) 
+    {
+        _Shader_File_Prefetch_Array wave = {0};
+        _Shader_File_Prefetch_Array next_wave = {0};
+        Path_Array seen = {0};
+        wave.allocator = arena.alloc;
+        next_wave.allocator = arena.alloc;
+        seen.allocator = arena.alloc;
+
+        _Shader_File_Prefetch root = {0};
+        root.full_path = path_make_absolute(arena.alloc, current_dir, path);
+        array_push(&wave, root);
+        array_push(&seen, root.full_path.path);
+
+        while(wave.len > 0)
+        {
+            //Drop files we already have. Their includes were resolved when they were first loaded.
+            isize kept = 0;
+            for(isize i = 0; i < wave.len; i++)
+            {
+                i32 cached_i = _shader_file_cache_find(cache, wave.data[i].full_path.path);
+                if(cached_i == -1 || cache->data[cached_i].has_contents == false)
+                    wave.data[kept++] = wave.data[i];
+            }
+            array_resize(&wave, kept);
+
+            for(isize i = 0; i < wave.len; i++)
+                wave.data[i].contents = builder_make(allocator_get_malloc(), 0);
+
+            //Read all files of this wave. The calling thread participates as well.
+            //The pool only grows when a wave is wider than any before.
+            for(isize wanted = MIN(thread_count, wave.len) - 1; launched < wanted; launched++)
+                if(platform_thread_launch(&threads[launched], _shader_file_prefetch_thread, &batch, 0) != 0)
+                    break;
+
+            batch.files = wave.data;
+            batch.count = (i32) wave.len;
+            platform_atomic_store32(&batch.next, 0);
+            gl_semaphore_post(&batch.wave_ready, (i32) launched);
+            _shader_file_prefetch_worker(&batch);
+
+            //Every post of wave_ready is answered by one post of wave_done so after this no worker touches the wave
+            for(isize i = 0; i < launched; i++)
+                gl_semaphore_wait(&batch.wave_done);
+            
+            //Move the results into the cache deterministically (in wave order) and collect the next wave
+            array_clear(&next_wave);
+            for(isize i = 0; i < wave.len; i++)
+            {
+                _Shader_File_Prefetch* file = &wave.data[i];
+                if(file->file_error == 0)
+                {
+                    i32 entry_i = _shader_file_cache_find(cache, file->full_path.path);
+                    if(entry_i == -1)
+                        entry_i = _shader_file_cache_add(cache, file->full_path);
+
+                    Shader_File_Cache_Entry* entry = &cache->data[entry_i];
+                    builder_assign(&entry->contents, file->contents.string);
+                    entry->file_info = file->file_info;
+                    entry->has_contents = true;
+
+                    //The entry might be left over from a failed read. It was never processed
+                    // so it is okay again until processing says otherwise.
+                    entry->file_error = 0;
+                    entry->has_processed = false;
+                    entry->okay = true;
+
+                    _Shader_Include_Array includes = {0};
+                    includes.allocator = arena.alloc;
+                    _shader_source_scan_includes(entry->contents.string, &includes);
+
+                    Path directory = path_strip_to_containing_directory(entry->full_path.path);
+                    for(isize j = 0; j < includes.len; j++)
+                    {
+                        _Shader_File_Prefetch included = {0};
+                        included.full_path = path_make_absolute(arena.alloc, directory, path_parse(includes.data[j]));
+
+                        bool was_seen = false;
+                        for(isize k = 0; k < seen.len && was_seen == false; k++)
+                            was_seen = path_is_equal_except_prefix(included.full_path.path, seen.data[k]);
+
+                        if(was_seen == false)
+                        {
+                            array_push(&seen, included.full_path.path);
+                            array_push(&next_wave, included);
+                        }
+                    }
+                }
+
+                builder_deinit(&file->contents);
+            }
+
+            _Shader_File_Prefetch_Array processed_wave = wave;
+            wave = next_wave;
+            next_wave = processed_wave;
+        }
+
+        result = shader_file_load_into_cache_and_handle_inclusion(cache, current_dir, path);
+    }
+
+    platform_atomic_store32(&batch.should_stop, 1);
+    gl_semaphore_post(&batch.wave_ready, (i32) launched);
+    platform_thread_join(threads, launched);
+    gl_semaphore_deinit(&batch.wave_ready);
+    gl_semaphore_deinit(&batch.wave_done);
+    return result;
+}
+
 String_Builder shader_source_prepend(Allocator* alloc, Shader_File_Cache_Entry* entry, const String* prepends, isize prepend_count, String default_version)
 {
     isize combined_size = 0;
@@ -537,7 +908,11 @@ String_Builder add_line_numbers(Allocator* alloc, String string)
     return builder;
 }
 
-bool compute_shader_init_from_disk(Shader_File_Cache* cache, GL_Shader* shader, String path, isize block_size_x, isize block_size_y, isize block_size_z)
+//Same as compute_shader_init_from_disk but additionally prepends defines (any source really) after the block sizes.
+//Used to compile several variants of the same kernel file.
+//Every kernel also gets DISPATCH_GROUP_ID and DISPATCH_GLOBAL_ID which are gl_WorkGroupID and gl_GlobalInvocationID
+// of the whole (possibly split) compute_shader_dispatch. Kernels using them can be dispatched with any size.
+bool compute_shader_init_from_disk_with_defines(Shader_File_Cache* cache, GL_Shader* shader, String path, isize block_size_x, isize block_size_y, isize block_size_z, String defines)
 {
     bool state = true;
     PROFILE_START();
@@ -560,8 +935,12 @@ bool compute_shader_init_from_disk(Shader_File_Cache* cache, GL_Shader* shader,
                 "\n #define CUSTOM_DEFINES"
                 "\n #define BLOCK_SIZE_X %lli"
                 "\n #define BLOCK_SIZE_Y %lli"
-                "\n #define BLOCK_SIZE_Z %lli",
-                block_size_x, block_size_y, block_size_z
+                "\n #define BLOCK_SIZE_Z %lli"
+                "\n uniform uvec3 u_dispatch_group_offset;"
+                "\n #define DISPATCH_GROUP_ID (gl_WorkGroupID + u_dispatch_group_offset)"
+                "\n #define DISPATCH_GLOBAL_ID (DISPATCH_GROUP_ID * gl_WorkGroupSize + gl_LocalInvocationID)"
+                "\n%.*s",
+                block_size_x, block_size_y, block_size_z, STRING_PRINT(defines)
             );
     
             String_Builder prepended = shader_source_prepend(arena.alloc, entry, &prepend, 1, STRING("#version 4.0"));
@@ -580,6 +959,7 @@ bool compute_shader_init_from_disk(Shader_File_Cache* cache, GL_Shader* shader,
                 shader->block_size_size_x = (i32) block_size_x;
                 shader->block_size_size_y = (i32) block_size_y;
                 shader->block_size_size_z = (i32) block_size_z;
+                shader->group_offset_location = glGetUniformLocation(shader_handle, "u_dispatch_group_offset") + 1;
             }
         }
     }
@@ -588,6 +968,11 @@ bool compute_shader_init_from_disk(Shader_File_Cache* cache, GL_Shader* shader,
     return state;
 }
 
+bool compute_shader_init_from_disk(Shader_File_Cache* cache, GL_Shader* shader, String path, isize block_size_x, isize block_size_y, isize block_size_z)
+{
+    return compute_shader_init_from_disk_with_defines(cache, shader, path, block_size_x, block_size_y, block_size_z, STRING(""));
+}
+
 bool render_shader_init_from_disk_with_geometry(Shader_File_Cache* cache, GL_Shader* shader, String path, bool has_geometry)
 {
     bool state = true;
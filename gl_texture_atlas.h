@@ -0,0 +1,480 @@
+#pragma once
+
+//Atlas for many small images (icons, glyphs, sprites) packed into the layers of a single GL_TEXTURE_2D_ARRAY
+// so that whole scenes can be drawn with one texture binding.
+//
+//Each layer is packed with a shelf packer: images are placed left to right into horizontal shelves whose
+// height is picked on first use. Removing an image returns its space when it is the last one on its shelf
+// or when the shelf becomes empty, anything else is counted as wasted. texture_atlas_defragment incrementally
+// evacuates the most wasteful layer into the others with a budget of copies per call, so it can run every
+// frame in the background. The copies are GPU side (glCopyImageSubData).
+//
+//Handles stay valid until removed, but their rect can change through defragmentation so the layer and uvs should
+// be looked up with texture_atlas_get when drawing (or refreshed whenever atlas->version changes).
+//When all layers are full the array grows (up to max_layers) which changes atlas->texture.
+//The padded rect of every image is cleared to zero when the image is placed, so padding never shows leftovers of
+// removed or moved images and bleeding with linear filtering is limited. Clearing needs GL 4.4 (glClearTexSubImage),
+// without it the storage is never cleared and padding can contain anything.
+//Handles are the entry index in the low TEXTURE_ATLAS_HANDLE_INDEX_BITS and a generation in the rest, so a stale
+// handle is only mistaken for a new one after 4096 reuses of its entry.
+//Growing stops early when the larger texture would not fit into the gl_memory budget.
+//Growing and defragmentation need GL 4.3. Shaders sample it with sampler2DArray at vec3(uv, layer).
+
+#include "gl.h"
+#include "gl_pixel_format.h"
+#include "gl_memory.h"
+#include "../lib/log.h"
+
+typedef u32 Texture_Atlas_Handle; //0 is invalid
+
+enum {
+    TEXTURE_ATLAS_HANDLE_INDEX_BITS = 20,
+    TEXTURE_ATLAS_HANDLE_INDEX_MASK = (1 << TEXTURE_ATLAS_HANDLE_INDEX_BITS) - 1,
+    TEXTURE_ATLAS_HANDLE_GENERATION_MASK = (1 << (32 - TEXTURE_ATLAS_HANDLE_INDEX_BITS)) - 1,
+};
+
+typedef struct Texture_Atlas_Rect {
+    i32 layer;
+    i32 x;
+    i32 y;
+    i32 width;
+    i32 height;
+    f32 u0; //uv rect within the layer
+    f32 v0;
+    f32 u1;
+    f32 v1;
+} Texture_Atlas_Rect;
+
+typedef struct _Texture_Atlas_Shelf {
+    i32 y;
+    i32 height;
+    i32 x_end;    //everything to the right is free
+    i32 live;     //images on this shelf
+    i64 wasted;   //area of removed images that could not be given back yet
+} _Texture_Atlas_Shelf;
+
+typedef Array(_Texture_Atlas_Shelf) _Texture_Atlas_Shelf_Array;
+
+typedef struct _Texture_Atlas_Layer {
+    _Texture_Atlas_Shelf_Array shelves; //sorted by y
+    i32 shelves_end;                    //y where the next shelf would start
+    i32 live;
+    i64 wasted;
+} _Texture_Atlas_Layer;
+
+typedef struct _Texture_Atlas_Entry {
+    i32 layer;
+    i32 shelf;
+    i32 x;
+    i32 y;
+    i32 width;
+    i32 height;
+    u16 generation;     //only the low 32 - TEXTURE_ATLAS_HANDLE_INDEX_BITS bits are used
+    bool used;
+} _Texture_Atlas_Entry;
+
+typedef Array(_Texture_Atlas_Layer) _Texture_Atlas_Layer_Array;
+typedef Array(_Texture_Atlas_Entry) _Texture_Atlas_Entry_Array;
+typedef Array(i32) _Texture_Atlas_Index_Array;
+
+typedef struct Texture_Atlas {
+    GLuint texture;
+    GL_Pixel_Format format;
+    i32 pixel_size;
+    i32 layer_size;      //width and height of every layer
+    i32 max_layers;
+    i32 padding;
+    i32 evacuating;      //layer being defragmented or -1. Nothing new gets placed there
+    u64 version;         //incremented every time any rect changes
+
+    _Texture_Atlas_Layer_Array layers;
+    _Texture_Atlas_Entry_Array entries;
+    _Texture_Atlas_Index_Array free_entries;
+} Texture_Atlas;
+
+void texture_atlas_deinit(Texture_Atlas* atlas)
+{
+    for(isize i = 0; i < atlas->layers.len; i++)
+        array_deinit(&atlas->layers.data[i].shelves);
+
+    gl_memory_untrack(GL_MEMORY_TEXTURE, atlas->texture);
+    glDeleteTextures(1, &atlas->texture);
+    array_deinit(&atlas->layers);
+    array_deinit(&atlas->entries);
+    array_deinit(&atlas->free_entries);
+    memset(atlas, 0, sizeof *atlas);
+}
+
+//Returns 0 if the texture does not fit into the gl_memory budget
+INTERNAL GLuint _texture_atlas_make_texture(const Texture_Atlas* atlas, i32 layer_count)
+{
+    i64 bytes = gl_memory_texture_bytes(atlas->format.internal_format, atlas->layer_size, atlas->layer_size, layer_count, 1, 1);
+    if(gl_memory_check_budget(bytes, "Texture_Atlas") == false)
+        return 0;
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, atlas->format.internal_format, atlas->layer_size, atlas->layer_size, layer_count);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    //Immutable storage is uninitialized. Padding has to be zero.
+    //Without GL 4.4 nothing is cleared (see the top of the file).
+    if(GLAD_GL_VERSION_4_4)
+        glClearTexImage(texture, 0, atlas->format.access_format, atlas->format.channel_type, NULL);
+
+    gl_memory_track(GL_MEMORY_TEXTURE, texture, bytes, "Texture_Atlas");
+    return texture;
+}
+
+INTERNAL void _texture_atlas_add_layers(Texture_Atlas* atlas, i32 layer_count)
+{
+    isize from = atlas->layers.len;
+    array_resize(&atlas->layers, layer_count);
+    for(isize i = from; i < layer_count; i++)
+    {
+        _Texture_Atlas_Layer* layer = &atlas->layers.data[i];
+        memset(layer, 0, sizeof *layer);
+        layer->shelves.allocator = atlas->layers.allocator;
+    }
+}
+
+//Creates the atlas with initial_layers layers of layer_size x layer_size texels. padding is the number of
+// empty texels kept between images.
+bool texture_atlas_init(Texture_Atlas* atlas, Allocator* alloc, Pixel_Type type, i32 channels, i32 layer_size, i32 initial_layers, i32 max_layers, i32 padding)
+{
+    texture_atlas_deinit(atlas);
+    atlas->format = gl_pixel_format_from_pixel_type(type, channels);
+    if(atlas->format.internal_format == 0)
+    {
+        LOG_ERROR("RENDER", "texture_atlas_init: unsupported pixel type %i with %i channels", (int) type, (int) channels);
+        return false;
+    }
+
+    GLint max_texture_size = 0;
+    GLint max_array_layers = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_array_layers);
+
+    atlas->pixel_size = (i32) pixel_type_size(type) * channels;
+    atlas->layer_size = MIN(layer_size, max_texture_size);
+    atlas->max_layers = MAX(MIN(max_layers, max_array_layers), 1);
+    atlas->padding = MAX(padding, 0);
+    atlas->evacuating = -1;
+    atlas->layers.allocator = alloc;
+    atlas->entries.allocator = alloc;
+    atlas->free_entries.allocator = alloc;
+
+    i32 layer_count = MAX(MIN(initial_layers, atlas->max_layers), 1);
+    _texture_atlas_add_layers(atlas, layer_count);
+    atlas->texture = _texture_atlas_make_texture(atlas, layer_count);
+    if(atlas->texture == 0)
+    {
+        texture_atlas_deinit(atlas);
+        return false;
+    }
+
+    LOG_INFO("RENDER", "texture_atlas_init %i x %i layers: %i (max %i)", atlas->layer_size, atlas->layer_size, layer_count, atlas->max_layers);
+    return true;
+}
+
+//Doubles the number of layers copying over the old contents. Returns false when at max_layers or over the memory budget.
+INTERNAL bool _texture_atlas_grow(Texture_Atlas* atlas)
+{
+    i32 old_count = (i32) atlas->layers.len;
+    i32 new_count = MIN(old_count*2, atlas->max_layers);
+    if(new_count <= old_count || GLAD_GL_VERSION_4_3 == 0)
+        return false;
+
+    GLuint texture = _texture_atlas_make_texture(atlas, new_count);
+    if(texture == 0)
+        return false;
+
+    glCopyImageSubData(atlas->texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+        texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, atlas->layer_size, atlas->layer_size, old_count);
+    gl_memory_untrack(GL_MEMORY_TEXTURE, atlas->texture);
+    glDeleteTextures(1, &atlas->texture);
+    atlas->texture = texture;
+
+    _texture_atlas_add_layers(atlas, new_count);
+    LOG_INFO("RENDER", "texture_atlas grew to %i layers", new_count);
+    return true;
+}
+
+//Finds space for a padded width x height rect in the given layer. Picks the lowest shelf that fits
+// and is not much taller, otherwise opens a new one. Returns the shelf index or -1.
+INTERNAL i32 _texture_atlas_layer_allocate(Texture_Atlas* atlas, i32 layer_index, i32 width, i32 height, i32* x, i32* y)
+{
+    _Texture_Atlas_Layer* layer = &atlas->layers.data[layer_index];
+    i32 best = -1;
+    for(i32 i = 0; i < layer->shelves.len; i++)
+    {
+        _Texture_Atlas_Shelf* shelf = &layer->shelves.data[i];
+        if(shelf->live == 0)
+            shelf->x_end = 0;
+
+        bool fits = shelf->height >= height && shelf->x_end + width <= atlas->layer_size;
+        bool not_wasteful = shelf->height <= height + height/2 || shelf->live == 0;
+        if(fits && not_wasteful && (best == -1 || shelf->height < layer->shelves.data[best].height))
+            best = i;
+    }
+
+    if(best == -1 && layer->shelves_end + height <= atlas->layer_size && width <= atlas->layer_size)
+    {
+        _Texture_Atlas_Shelf shelf = {0};
+        shelf.y = layer->shelves_end;
+        shelf.height = height;
+        array_push(&layer->shelves, shelf);
+        layer->shelves_end += height;
+        best = (i32) layer->shelves.len - 1;
+    }
+
+    if(best != -1)
+    {
+        _Texture_Atlas_Shelf* shelf = &layer->shelves.data[best];
+        *x = shelf->x_end;
+        *y = shelf->y;
+        shelf->x_end += width;
+        shelf->live += 1;
+        layer->live += 1;
+    }
+    return best;
+}
+
+INTERNAL void _texture_atlas_layer_free(Texture_Atlas* atlas, const _Texture_Atlas_Entry* entry)
+{
+    _Texture_Atlas_Layer* layer = &atlas->layers.data[entry->layer];
+    _Texture_Atlas_Shelf* shelf = &layer->shelves.data[entry->shelf];
+    i32 padded_width = entry->width + atlas->padding;
+    i64 padded_area = (i64) padded_width*shelf->height;
+
+    shelf->live -= 1;
+    layer->live -= 1;
+    if(shelf->live == 0)
+    {
+        layer->wasted -= shelf->wasted;
+        shelf->wasted = 0;
+        shelf->x_end = 0;
+    }
+    else if(entry->x + padded_width == shelf->x_end)
+        shelf->x_end = entry->x;
+    else
+    {
+        shelf->wasted += padded_area;
+        layer->wasted += padded_area;
+    }
+
+    //Empty shelves at the top give their height back
+    while(layer->shelves.len > 0 && array_last(layer->shelves)->live == 0)
+    {
+        layer->shelves_end = array_last(layer->shelves)->y;
+        array_pop(&layer->shelves);
+    }
+}
+
+INTERNAL bool _texture_atlas_place(Texture_Atlas* atlas, _Texture_Atlas_Entry* entry, i32 width, i32 height)
+{
+    i32 padded_width = width + atlas->padding;
+    i32 padded_height = height + atlas->padding;
+    for(i32 attempt = 0; attempt < 2; attempt++)
+    {
+        for(i32 i = 0; i < atlas->layers.len; i++)
+        {
+            if(i == atlas->evacuating)
+                continue;
+
+            i32 x = 0, y = 0;
+            i32 shelf = _texture_atlas_layer_allocate(atlas, i, padded_width, padded_height, &x, &y);
+            if(shelf != -1)
+            {
+                entry->layer = i;
+                entry->shelf = shelf;
+                entry->x = x;
+                entry->y = y;
+                entry->width = width;
+                entry->height = height;
+                return true;
+            }
+        }
+
+        if(attempt == 0 && _texture_atlas_grow(atlas) == false)
+            break;
+    }
+    return false;
+}
+
+//Zeroes the rect of the entry together with its padding so that freed space does not bleed into it
+INTERNAL void _texture_atlas_clear_padded(Texture_Atlas* atlas, const _Texture_Atlas_Entry* entry)
+{
+    if(atlas->padding > 0 && GLAD_GL_VERSION_4_4)
+        glClearTexSubImage(atlas->texture, 0, entry->x, entry->y, entry->layer,
+            entry->width + atlas->padding, entry->height + atlas->padding, 1, atlas->format.access_format, atlas->format.channel_type, NULL);
+}
+
+INTERNAL _Texture_Atlas_Entry* _texture_atlas_entry(Texture_Atlas* atlas, Texture_Atlas_Handle handle)
+{
+    isize index = (isize) (handle & TEXTURE_ATLAS_HANDLE_INDEX_MASK) - 1;
+    if(index < 0 || index >= atlas->entries.len)
+        return NULL;
+
+    _Texture_Atlas_Entry* entry = &atlas->entries.data[index];
+    if(entry->used == false || entry->generation != (handle >> TEXTURE_ATLAS_HANDLE_INDEX_BITS))
+        return NULL;
+    return entry;
+}
+
+//Copies width x height tightly packed pixels of the atlas format into the atlas.
+//Returns 0 when the image does not fit even after growing to max_layers.
+Texture_Atlas_Handle texture_atlas_insert(Texture_Atlas* atlas, const void* pixels, i32 width, i32 height)
+{
+    _Texture_Atlas_Entry placed = {0};
+    if(width <= 0 || height <= 0 || _texture_atlas_place(atlas, &placed, width, height) == false)
+    {
+        LOG_ERROR("RENDER", "texture_atlas_insert: no space for a %i x %i image", width, height);
+        return 0;
+    }
+
+    i32 index = 0;
+    if(atlas->free_entries.len > 0)
+    {
+        index = *array_last(atlas->free_entries);
+        array_pop(&atlas->free_entries);
+    }
+    else
+    {
+        index = (i32) atlas->entries.len;
+        _Texture_Atlas_Entry empty = {0};
+        array_push(&atlas->entries, empty);
+    }
+    ASSERT(index < TEXTURE_ATLAS_HANDLE_INDEX_MASK);
+
+    _Texture_Atlas_Entry* entry = &atlas->entries.data[index];
+    placed.generation = entry->generation;
+    placed.used = true;
+    *entry = placed;
+
+    _texture_atlas_clear_padded(atlas, entry);
+    //Rows of pixels are tightly packed. The callers unpack alignment is restored afterwards
+    GLint unpack_alignment = 4;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, atlas->texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, entry->x, entry->y, entry->layer, width, height, 1,
+        atlas->format.access_format, atlas->format.channel_type, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    return ((u32) entry->generation << TEXTURE_ATLAS_HANDLE_INDEX_BITS) | (u32) (index + 1);
+}
+
+//Frees the space of the image. The handle becomes invalid.
+void texture_atlas_remove(Texture_Atlas* atlas, Texture_Atlas_Handle handle)
+{
+    _Texture_Atlas_Entry* entry = _texture_atlas_entry(atlas, handle);
+    ASSERT(entry != NULL && "invalid or already removed handle");
+    if(entry == NULL)
+        return;
+
+    _texture_atlas_layer_free(atlas, entry);
+    entry->used = false;
+    entry->generation = (u16) ((entry->generation + 1) & TEXTURE_ATLAS_HANDLE_GENERATION_MASK);
+    array_push(&atlas->free_entries, (i32) (entry - atlas->entries.data));
+}
+
+//Returns false and a zeroed rect for invalid handles
+bool texture_atlas_get(const Texture_Atlas* atlas, Texture_Atlas_Handle handle, Texture_Atlas_Rect* rect)
+{
+    memset(rect, 0, sizeof *rect);
+    _Texture_Atlas_Entry* entry = _texture_atlas_entry((Texture_Atlas*) atlas, handle);
+    if(entry == NULL)
+        return false;
+
+    f32 size = (f32) atlas->layer_size;
+    rect->layer = entry->layer;
+    rect->x = entry->x;
+    rect->y = entry->y;
+    rect->width = entry->width;
+    rect->height = entry->height;
+    rect->u0 = (f32) entry->x / size;
+    rect->v0 = (f32) entry->y / size;
+    rect->u1 = (f32) (entry->x + entry->width) / size;
+    rect->v1 = (f32) (entry->y + entry->height) / size;
+    return true;
+}
+
+//Wasted area of a layer relative to its size
+f32 texture_atlas_layer_fragmentation(const Texture_Atlas* atlas, i32 layer)
+{
+    return (f32) atlas->layers.data[layer].wasted / ((f32) atlas->layer_size * (f32) atlas->layer_size);
+}
+
+//Moves up to max_moves images out of the most fragmented layer (once it is more than min_fragmentation wasted)
+// into the other layers. Once the layer is empty its space is whole again. Returns the number of moved images.
+isize texture_atlas_defragment(Texture_Atlas* atlas, isize max_moves, f32 min_fragmentation)
+{
+    if(GLAD_GL_VERSION_4_3 == 0 || atlas->layers.len < 2)
+        return 0;
+
+    if(atlas->evacuating == -1)
+    {
+        f32 worst = min_fragmentation;
+        for(i32 i = 0; i < atlas->layers.len; i++)
+        {
+            f32 fragmentation = texture_atlas_layer_fragmentation(atlas, i);
+            if(fragmentation > worst)
+            {
+                worst = fragmentation;
+                atlas->evacuating = i;
+            }
+        }
+    }
+
+    if(atlas->evacuating == -1)
+        return 0;
+
+    isize moved = 0;
+    i32 from_layer = atlas->evacuating;
+    for(isize i = 0; i < atlas->entries.len && moved < max_moves; i++)
+    {
+        _Texture_Atlas_Entry* entry = &atlas->entries.data[i];
+        if(entry->used == false || entry->layer != from_layer)
+            continue;
+
+        //Placing never grows the atlas here: evacuating into freshly added layers would only move the problem
+        _Texture_Atlas_Entry placed = *entry;
+        i32 max_layers = atlas->max_layers;
+        atlas->max_layers = (i32) atlas->layers.len;
+        bool ok = _texture_atlas_place(atlas, &placed, entry->width, entry->height);
+        atlas->max_layers = max_layers;
+        if(ok == false)
+        {
+            //The other layers are full. Give up on this layer for now.
+            atlas->evacuating = -1;
+            break;
+        }
+
+        _texture_atlas_clear_padded(atlas, &placed);
+        glCopyImageSubData(atlas->texture, GL_TEXTURE_2D_ARRAY, 0, entry->x, entry->y, entry->layer,
+            atlas->texture, GL_TEXTURE_2D_ARRAY, 0, placed.x, placed.y, placed.layer, entry->width, entry->height, 1);
+
+        _texture_atlas_layer_free(atlas, entry);
+        *entry = placed;
+        atlas->version += 1;
+        moved += 1;
+    }
+
+    if(atlas->evacuating != -1 && atlas->layers.data[atlas->evacuating].live == 0)
+    {
+        _Texture_Atlas_Layer* layer = &atlas->layers.data[atlas->evacuating];
+        array_clear(&layer->shelves);
+        layer->shelves_end = 0;
+        layer->wasted = 0;
+        atlas->evacuating = -1;
+    }
+
+    return moved;
+}
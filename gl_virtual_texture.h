@@ -0,0 +1,466 @@
+#pragma once
+
+//Virtual texturing for images bigger than GL_MAX_TEXTURE_SIZE or the memory budget.
+//
+//The virtual image is split into square pages. Only the pages requested through virtual_texture_request_region
+// are kept resident in a single physical atlas texture. When the atlas is full the least recently requested
+// page is evicted. Pages are loaded (copied out of the source Image or produced by a custom loader, ie.
+// decoded from disk) on worker threads and uploaded on the GL thread in virtual_texture_update.
+//
+//Shaders translate virtual uvs through the page table texture (GL_RG16UI, one texel per page) holding the
+// atlas slot of each page or 0xFFFF when not resident. See VIRTUAL_TEXTURE_GLSL_LOOKUP.
+//The atlas is sampled with GL_NEAREST since pages have no borders.
+//Workers sleep on a semaphore that is posted once per queued page. Eviction takes the least recently
+// requested resident page from the front of an LRU list of slots kept in request order.
+
+#include "gl.h"
+#include "gl_pixel_format.h"
+#include "gl_memory.h"
+#include "gl_semaphore.h"
+#include "../lib/platform.h"
+#include "../lib/log.h"
+#include <stdlib.h>
+
+#define VIRTUAL_TEXTURE_NOT_RESIDENT 0xFFFF
+
+//The shader has to define VIRTUAL_TEXTURE_PAGE_SIZE to the page_size passed to virtual_texture_init
+// before this code, ie. format("#define VIRTUAL_TEXTURE_PAGE_SIZE %i\n", texture.page_size).
+#define VIRTUAL_TEXTURE_GLSL_LOOKUP \
+    "//returns false when the page is not resident\n" \
+    "bool virtual_texture_lookup(usampler2D page_table, sampler2D atlas, vec2 uv, out vec4 color)\n" \
+    "{\n" \
+    "    vec2 pages = vec2(textureSize(page_table, 0));\n" \
+    "    vec2 page_uv = uv * pages;\n" \
+    "    uvec2 slot = texelFetch(page_table, ivec2(page_uv), 0).xy;\n" \
+    "    if(slot.x == 0xFFFFu)\n" \
+    "        return false;\n" \
+    "    vec2 atlas_slots = vec2(textureSize(atlas, 0)) / float(VIRTUAL_TEXTURE_PAGE_SIZE);\n" \
+    "    color = texture(atlas, (vec2(slot) + fract(page_uv)) / atlas_slots);\n" \
+    "    return true;\n" \
+    "}\n"
+
+//Writes the pixels of page (page_x, page_y) into into. Rows are row_stride bytes apart.
+//Pages at the right and bottom edge may be only partially covered by the image, the rest should be filled with anything.
+//Called from worker threads!
+typedef void (*Virtual_Texture_Page_Loader)(void* context, i32 page_x, i32 page_y, i32 page_size, u8* into, isize row_stride);
+
+typedef struct _Virtual_Texture_Page {
+    i32 page;      //page_x + page_y*pages_x
+    u8* pixels;    //page_size*page_size*pixel_size. NULL while queued
+} _Virtual_Texture_Page;
+
+typedef Array(_Virtual_Texture_Page) _Virtual_Texture_Page_Array;
+typedef Array(i32) _Virtual_Texture_Index_Array;
+typedef Array(i64) _Virtual_Texture_Frame_Array;
+typedef Array(u16) _Virtual_Texture_Table_Array;
+
+enum {VIRTUAL_TEXTURE_MAX_WORKERS = 16};
+
+typedef struct Virtual_Texture {
+    GL_Pixel_Format format;
+    i32 pixel_size;
+    i32 page_size;
+    i32 width;
+    i32 height;
+    i32 pages_x;
+    i32 pages_y;
+    i32 atlas_slots_x;
+    i32 atlas_slots_y;
+
+    GLuint atlas_texture;
+    GLuint page_table_texture;
+
+    //Only touched by the GL thread
+    _Virtual_Texture_Index_Array page_to_slot;   //-1 when not resident
+    _Virtual_Texture_Index_Array slot_to_page;   //-1 when free
+    _Virtual_Texture_Frame_Array page_last_used; //frame the page was last requested in
+    _Virtual_Texture_Table_Array page_table;     //2 per page, mirrors page_table_texture
+    _Virtual_Texture_Index_Array free_slots;     //stack of slots holding no page
+    _Virtual_Texture_Index_Array lru_prev;       //per slot links of the LRU list of occupied slots. -1 is the end
+    _Virtual_Texture_Index_Array lru_next;
+    i32 lru_first;                               //least recently requested slot or -1
+    i32 lru_last;                                //most recently requested slot or -1
+    u8* page_is_pending;                         //queued or loading. Also only touched by the GL thread
+    bool page_table_dirty;
+    i64 frame;
+
+    //Shared with the workers, guarded by mutex
+    Platform_Mutex mutex;
+    _Virtual_Texture_Page_Array queued;
+    _Virtual_Texture_Page_Array loaded;
+    GL_Semaphore queued_semaphore;               //posted once per queued page and once per worker to stop
+
+    Virtual_Texture_Page_Loader loader;
+    void* loader_context;
+    Platform_Thread workers[VIRTUAL_TEXTURE_MAX_WORKERS];
+    i32 worker_count;
+    volatile i32 should_stop;
+
+    isize uploads_total;
+    isize evictions_total;
+} Virtual_Texture;
+
+//Loader copying pages out of an in memory Image passed as context.
+void virtual_texture_image_loader(void* context, i32 page_x, i32 page_y, i32 page_size, u8* into, isize row_stride)
+{
+    const Image* image = (const Image*) context;
+    isize pixel_size = image->pixel_size;
+    i32 from_x = page_x * page_size;
+    i32 from_y = page_y * page_size;
+    i32 copy_width = MAX(MIN(page_size, image->width - from_x), 0);
+    i32 copy_height = MAX(MIN(page_size, image->height - from_y), 0);
+
+    for(i32 y = 0; y < page_size; y++)
+    {
+        u8* row = into + y*row_stride;
+        if(y < copy_height)
+        {
+            const u8* source = image->pixels + ((isize) (from_y + y)*image->width + from_x)*pixel_size;
+            memcpy(row, source, (size_t) (copy_width*pixel_size));
+            memset(row + copy_width*pixel_size, 0, (size_t) ((page_size - copy_width)*pixel_size));
+        }
+        else
+            memset(row, 0, (size_t) (page_size*pixel_size));
+    }
+}
+
+INTERNAL void _virtual_texture_worker(void* context)
+{
+    Virtual_Texture* texture = (Virtual_Texture*) context;
+    isize page_bytes = (isize) texture->page_size*texture->page_size*texture->pixel_size;
+    for(;;)
+    {
+        gl_semaphore_wait(&texture->queued_semaphore);
+        if(platform_atomic_load32(&texture->should_stop))
+            break;
+
+        _Virtual_Texture_Page job = {-1};
+        platform_mutex_lock(&texture->mutex);
+        if(texture->queued.len > 0)
+            job = *array_last(texture->queued); //newest request first, that is what is on screen now
+        if(job.page != -1)
+            array_pop(&texture->queued);
+        platform_mutex_unlock(&texture->mutex);
+
+        if(job.page == -1)
+            continue;
+
+        job.pixels = (u8*) malloc((size_t) page_bytes);
+        i32 page_x = job.page % texture->pages_x;
+        i32 page_y = job.page / texture->pages_x;
+        texture->loader(texture->loader_context, page_x, page_y, texture->page_size, job.pixels, (isize) texture->page_size*texture->pixel_size);
+
+        platform_mutex_lock(&texture->mutex);
+        array_push(&texture->loaded, job);
+        platform_mutex_unlock(&texture->mutex);
+    }
+}
+
+void virtual_texture_deinit(Virtual_Texture* texture)
+{
+    if(texture->worker_count > 0)
+    {
+        platform_atomic_store32(&texture->should_stop, 1);
+        gl_semaphore_post(&texture->queued_semaphore, texture->worker_count);
+        platform_thread_join(texture->workers, texture->worker_count);
+        platform_mutex_deinit(&texture->mutex);
+        gl_semaphore_deinit(&texture->queued_semaphore);
+    }
+
+    for(isize i = 0; i < texture->loaded.len; i++)
+        free(texture->loaded.data[i].pixels);
+
+    gl_memory_untrack(GL_MEMORY_TEXTURE, texture->atlas_texture);
+    gl_memory_untrack(GL_MEMORY_TEXTURE, texture->page_table_texture);
+    glDeleteTextures(1, &texture->atlas_texture);
+    glDeleteTextures(1, &texture->page_table_texture);
+    array_deinit(&texture->page_to_slot);
+    array_deinit(&texture->slot_to_page);
+    array_deinit(&texture->page_last_used);
+    array_deinit(&texture->page_table);
+    array_deinit(&texture->free_slots);
+    array_deinit(&texture->lru_prev);
+    array_deinit(&texture->lru_next);
+    array_deinit(&texture->queued);
+    array_deinit(&texture->loaded);
+    free(texture->page_is_pending);
+    memset(texture, 0, sizeof *texture);
+}
+
+//Creates a virtual texture of width x height texels of the given pixel type. The atlas gets as many pages as fit
+// into atlas_budget_bytes (and GL_MAX_TEXTURE_SIZE). Pages are produced by loader on worker_count threads.
+//Integer pixel types are rejected since VIRTUAL_TEXTURE_GLSL_LOOKUP samples the atlas as a float sampler2D.
+bool virtual_texture_init(Virtual_Texture* texture, Allocator* alloc, i32 width, i32 height, Pixel_Type type, i32 channels,
+    i32 page_size, isize atlas_budget_bytes, Virtual_Texture_Page_Loader loader, void* loader_context, i32 worker_count)
+{
+    virtual_texture_deinit(texture);
+    texture->format = gl_pixel_format_from_pixel_type(type, channels);
+    if(texture->format.internal_format == 0)
+    {
+        LOG_ERROR("RENDER", "virtual_texture_init: unsupported pixel type %i with %i channels", (int) type, (int) channels);
+        return false;
+    }
+
+    GLuint access = texture->format.access_format;
+    if(access == GL_RED_INTEGER || access == GL_RG_INTEGER || access == GL_RGB_INTEGER || access == GL_RGBA_INTEGER)
+    {
+        LOG_ERROR("RENDER", "virtual_texture_init: integer pixel type %i is not supported", (int) type);
+        return false;
+    }
+
+    GLint max_texture_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size);
+
+    texture->pixel_size = (i32) pixel_type_size(type) * channels;
+    texture->page_size = page_size;
+    texture->width = width;
+    texture->height = height;
+    texture->pages_x = (i32) DIV_CEIL(width, page_size);
+    texture->pages_y = (i32) DIV_CEIL(height, page_size);
+    texture->loader = loader;
+    texture->loader_context = loader_context;
+
+    isize page_bytes = (isize) page_size*page_size*texture->pixel_size;
+    isize budget_slots = MAX(atlas_budget_bytes / page_bytes, 1);
+    i32 max_slots_side = max_texture_size / page_size;
+    i32 slots_side = 1;
+    while((isize) (slots_side + 1)*(slots_side + 1) <= budget_slots && slots_side + 1 <= max_slots_side)
+        slots_side += 1;
+    texture->atlas_slots_x = slots_side;
+    texture->atlas_slots_y = (i32) MIN(MAX(budget_slots / slots_side, 1), max_slots_side);
+
+    if(texture->pages_x > 0xFFFE || texture->pages_y > 0xFFFE || slots_side < 1)
+    {
+        LOG_ERROR("RENDER", "virtual_texture_init: invalid size %i x %i with page size %i", width, height, page_size);
+        return false;
+    }
+
+    i64 atlas_bytes = gl_memory_texture_bytes(texture->format.internal_format, texture->atlas_slots_x*page_size, texture->atlas_slots_y*page_size, 1, 1, 1);
+    i64 page_table_bytes = gl_memory_texture_bytes(GL_RG16UI, texture->pages_x, texture->pages_y, 1, 1, 1);
+    if(gl_memory_check_budget(atlas_bytes + page_table_bytes, "Virtual_Texture") == false)
+        return false;
+
+    isize page_count = (isize) texture->pages_x*texture->pages_y;
+    isize slot_count = (isize) texture->atlas_slots_x*texture->atlas_slots_y;
+    texture->page_to_slot.allocator = alloc;
+    texture->slot_to_page.allocator = alloc;
+    texture->page_last_used.allocator = alloc;
+    texture->page_table.allocator = alloc;
+    texture->free_slots.allocator = alloc;
+    texture->lru_prev.allocator = alloc;
+    texture->lru_next.allocator = alloc;
+    texture->queued.allocator = allocator_get_malloc();
+    texture->loaded.allocator = allocator_get_malloc();
+    array_resize(&texture->page_to_slot, page_count);
+    array_resize(&texture->slot_to_page, slot_count);
+    array_resize(&texture->page_last_used, page_count);
+    array_resize(&texture->page_table, page_count*2);
+    array_resize(&texture->free_slots, slot_count);
+    array_resize(&texture->lru_prev, slot_count);
+    array_resize(&texture->lru_next, slot_count);
+    texture->page_is_pending = (u8*) calloc((size_t) page_count, 1);
+
+    memset(texture->page_to_slot.data, 0xFF, (size_t) page_count*sizeof(i32));
+    memset(texture->slot_to_page.data, 0xFF, (size_t) slot_count*sizeof(i32));
+    memset(texture->page_last_used.data, 0, (size_t) page_count*sizeof(i64));
+    memset(texture->page_table.data, 0xFF, (size_t) page_count*2*sizeof(u16));
+    memset(texture->lru_prev.data, 0xFF, (size_t) slot_count*sizeof(i32));
+    memset(texture->lru_next.data, 0xFF, (size_t) slot_count*sizeof(i32));
+    texture->lru_first = -1;
+    texture->lru_last = -1;
+
+    //Reversed so that slots get used in order
+    for(isize i = 0; i < slot_count; i++)
+        texture->free_slots.data[i] = (i32) (slot_count - 1 - i);
+
+    glGenTextures(1, &texture->atlas_texture);
+    glBindTexture(GL_TEXTURE_2D, texture->atlas_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, texture->format.internal_format, texture->atlas_slots_x*page_size, texture->atlas_slots_y*page_size);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glGenTextures(1, &texture->page_table_texture);
+    glBindTexture(GL_TEXTURE_2D, texture->page_table_texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16UI, texture->pages_x, texture->pages_y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    texture->page_table_dirty = true;
+    gl_memory_track(GL_MEMORY_TEXTURE, texture->atlas_texture, atlas_bytes, "Virtual_Texture");
+    gl_memory_track(GL_MEMORY_TEXTURE, texture->page_table_texture, page_table_bytes, "Virtual_Texture");
+
+    LOG_INFO("RENDER", "virtual_texture_init %i x %i pages: %i x %i atlas slots: %i x %i",
+        width, height, texture->pages_x, texture->pages_y, texture->atlas_slots_x, texture->atlas_slots_y);
+
+    platform_mutex_init(&texture->mutex);
+    gl_semaphore_init(&texture->queued_semaphore);
+    worker_count = MAX(MIN(worker_count, VIRTUAL_TEXTURE_MAX_WORKERS), 1);
+    for(i32 i = 0; i < worker_count; i++)
+        if(platform_thread_launch(&texture->workers[texture->worker_count], _virtual_texture_worker, texture, 0) == 0)
+            texture->worker_count += 1;
+
+    if(texture->worker_count == 0)
+    {
+        LOG_ERROR("RENDER", "virtual_texture_init: failed to launch any worker thread");
+        //deinit only releases the mutex and semaphore when there are workers to stop
+        platform_mutex_deinit(&texture->mutex);
+        gl_semaphore_deinit(&texture->queued_semaphore);
+        virtual_texture_deinit(texture);
+        return false;
+    }
+
+    return true;
+}
+
+bool virtual_texture_init_from_image(Virtual_Texture* texture, Allocator* alloc, const Image* image, i32 page_size, isize atlas_budget_bytes, i32 worker_count)
+{
+    i32 channels = (i32) (image->pixel_size / pixel_type_size((Pixel_Type) image->type));
+    return virtual_texture_init(texture, alloc, image->width, image->height, (Pixel_Type) image->type, channels,
+        page_size, atlas_budget_bytes, virtual_texture_image_loader, (void*) image, worker_count);
+}
+
+INTERNAL void _virtual_texture_lru_unlink(Virtual_Texture* texture, i32 slot)
+{
+    i32 prev = texture->lru_prev.data[slot];
+    i32 next = texture->lru_next.data[slot];
+    if(prev != -1)
+        texture->lru_next.data[prev] = next;
+    else
+        texture->lru_first = next;
+
+    if(next != -1)
+        texture->lru_prev.data[next] = prev;
+    else
+        texture->lru_last = prev;
+
+    texture->lru_prev.data[slot] = -1;
+    texture->lru_next.data[slot] = -1;
+}
+
+//Makes slot the most recently requested one
+INTERNAL void _virtual_texture_lru_push_last(Virtual_Texture* texture, i32 slot)
+{
+    texture->lru_prev.data[slot] = texture->lru_last;
+    texture->lru_next.data[slot] = -1;
+    if(texture->lru_last != -1)
+        texture->lru_next.data[texture->lru_last] = slot;
+    else
+        texture->lru_first = slot;
+    texture->lru_last = slot;
+}
+
+//Marks the pages covering the given texel region as visible this frame. Pages that are not resident get queued for loading.
+void virtual_texture_request_region(Virtual_Texture* texture, i32 from_x, i32 from_y, i32 to_x, i32 to_y)
+{
+    i32 page_from_x = MAX(from_x / texture->page_size, 0);
+    i32 page_from_y = MAX(from_y / texture->page_size, 0);
+    i32 page_to_x = MIN((i32) DIV_CEIL(to_x, texture->page_size), texture->pages_x);
+    i32 page_to_y = MIN((i32) DIV_CEIL(to_y, texture->page_size), texture->pages_y);
+
+    i32 queued = 0;
+    platform_mutex_lock(&texture->mutex);
+    for(i32 y = page_from_y; y < page_to_y; y++)
+        for(i32 x = page_from_x; x < page_to_x; x++)
+        {
+            i32 page = x + y*texture->pages_x;
+            i32 slot = texture->page_to_slot.data[page];
+            texture->page_last_used.data[page] = texture->frame;
+            if(slot != -1)
+            {
+                _virtual_texture_lru_unlink(texture, slot);
+                _virtual_texture_lru_push_last(texture, slot);
+            }
+            else if(texture->page_is_pending[page] == false)
+            {
+                _Virtual_Texture_Page job = {page, NULL};
+                array_push(&texture->queued, job);
+                texture->page_is_pending[page] = true;
+                queued += 1;
+            }
+        }
+    platform_mutex_unlock(&texture->mutex);
+
+    if(queued > 0)
+        gl_semaphore_post(&texture->queued_semaphore, queued);
+}
+
+//Returns a free slot or evicts the least recently requested page. Pages requested this frame are never evicted
+// so returns -1 when all slots hold such pages.
+INTERNAL i32 _virtual_texture_find_slot(Virtual_Texture* texture)
+{
+    if(texture->free_slots.len > 0)
+    {
+        i32 slot = *array_last(texture->free_slots);
+        array_pop(&texture->free_slots);
+        return slot;
+    }
+
+    i32 lru_slot = texture->lru_first;
+    if(lru_slot == -1 || texture->page_last_used.data[texture->slot_to_page.data[lru_slot]] >= texture->frame)
+        return -1;
+
+    i32 evicted = texture->slot_to_page.data[lru_slot];
+    _virtual_texture_lru_unlink(texture, lru_slot);
+    texture->page_to_slot.data[evicted] = -1;
+    texture->page_table.data[evicted*2 + 0] = VIRTUAL_TEXTURE_NOT_RESIDENT;
+    texture->page_table.data[evicted*2 + 1] = VIRTUAL_TEXTURE_NOT_RESIDENT;
+    texture->slot_to_page.data[lru_slot] = -1;
+    texture->evictions_total += 1;
+    return lru_slot;
+}
+
+//Uploads up to max_uploads loaded pages into the atlas, updates the page table and advances the frame.
+//Call once per frame on the GL thread after all requests for the frame were made.
+void virtual_texture_update(Virtual_Texture* texture, isize max_uploads)
+{
+    enum {MAX_BATCH = 64};
+    _Virtual_Texture_Page batch[MAX_BATCH] = {0};
+    isize batch_count = 0;
+
+    platform_mutex_lock(&texture->mutex);
+    batch_count = MIN(MIN(texture->loaded.len, max_uploads), MAX_BATCH);
+    for(isize i = 0; i < batch_count; i++)
+        batch[i] = texture->loaded.data[texture->loaded.len - 1 - i];
+    array_resize(&texture->loaded, texture->loaded.len - batch_count);
+    platform_mutex_unlock(&texture->mutex);
+
+    GLint unpack_alignment = 4;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glBindTexture(GL_TEXTURE_2D, texture->atlas_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for(isize i = 0; i < batch_count; i++)
+    {
+        i32 page = batch[i].page;
+        i32 slot = _virtual_texture_find_slot(texture);
+        if(slot != -1)
+        {
+            i32 slot_x = slot % texture->atlas_slots_x;
+            i32 slot_y = slot / texture->atlas_slots_x;
+            glTexSubImage2D(GL_TEXTURE_2D, 0, slot_x*texture->page_size, slot_y*texture->page_size, texture->page_size, texture->page_size,
+                texture->format.access_format, texture->format.channel_type, batch[i].pixels);
+
+            texture->slot_to_page.data[slot] = page;
+            texture->page_to_slot.data[page] = slot;
+            _virtual_texture_lru_push_last(texture, slot);
+            texture->page_table.data[page*2 + 0] = (u16) slot_x;
+            texture->page_table.data[page*2 + 1] = (u16) slot_y;
+            texture->page_table_dirty = true;
+            texture->uploads_total += 1;
+        }
+
+        //When everything in the atlas is in use the page is dropped and will be requested again
+        texture->page_is_pending[page] = false;
+        free(batch[i].pixels);
+    }
+
+    if(texture->page_table_dirty)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture->page_table_texture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, texture->pages_x, texture->pages_y, GL_RG_INTEGER, GL_UNSIGNED_SHORT, texture->page_table.data);
+        texture->page_table_dirty = false;
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    texture->frame += 1;
+}
@@ -0,0 +1,422 @@
+#pragma once
+
+//Background GL thread for work that would otherwise stall the frame: texture and buffer uploads and
+// shader compilation/linking. The worker owns a context from the share group of the render context
+// and communicates through two single producer single consumer lock free rings:
+// the render thread submits jobs, the worker executes them and hands back the created objects together
+// with a fence. gl_worker_poll only returns a result once its fence has signaled so the render
+// thread can use the object right away and never waits on driver work.
+//The worker sleeps on a semaphore while there is no job (or no place for its result) and is woken by
+// gl_worker_submit, by gl_worker_poll freeing a place in a full result ring and by gl_worker_deinit.
+//
+//The shared context must be created by the caller (it is platform specific) on the render thread and released there.
+// The worker makes it current on its own thread. With gl_headless.h:
+//    GL_Headless_Context upload_context = {0};
+//    gl_headless_context_init(&upload_context, 4, 3, &main_context);
+//    gl_headless_context_release_current(&upload_context);
+//    gl_headless_context_make_current(&main_context);
+//    gl_worker_init(&worker, gl_worker_context_headless(&upload_context), 256);
+//
+//Jobs point to caller memory (pixels, sources...) which must stay alive until the result is polled.
+//Only one thread may submit and poll.
+
+#include "gl.h"
+#include "gl_pixel_format.h"
+#include "gl_shader_util.h"
+#include "gl_headless.h"
+#include "gl_semaphore.h"
+#include "../lib/platform.h"
+#include "../lib/log.h"
+#include <stdlib.h>
+
+typedef enum {
+    GL_WORKER_JOB_TEXTURE_UPLOAD,
+    GL_WORKER_JOB_BUFFER_UPLOAD,
+    GL_WORKER_JOB_PROGRAM,
+    GL_WORKER_JOB_CUSTOM,
+} GL_Worker_Job_Type;
+
+typedef struct GL_Worker_Texture_Upload {
+    const void* pixels;     //tightly packed rows of format.access_format/format.channel_type
+    i32 width;
+    i32 height;
+    i32 mip_levels;         //0 or 1 means no mips. Mips are generated with glGenerateMipmap
+    GL_Pixel_Format format;
+    GLenum filter;          //GL_NEAREST or GL_LINEAR. 0 means GL_LINEAR
+} GL_Worker_Texture_Upload;
+
+typedef struct GL_Worker_Buffer_Upload {
+    const void* data;       //can be NULL
+    isize size;
+    GLenum usage;           //0 means GL_STATIC_DRAW
+} GL_Worker_Buffer_Upload;
+
+typedef struct GL_Worker_Program {
+    const char* sources[MAX_SHADER_STAGES];
+    GLuint stages[MAX_SHADER_STAGES];
+    i32 stage_count;
+} GL_Worker_Program;
+
+//Runs on the worker thread with its context current. Returns the created object or 0.
+typedef GLuint (*GL_Worker_Custom_Func)(void* context);
+
+typedef struct GL_Worker_Job {
+    GL_Worker_Job_Type type;
+    void* user;             //passed through to the result
+    union {
+        GL_Worker_Texture_Upload texture;
+        GL_Worker_Buffer_Upload buffer;
+        GL_Worker_Program program;
+        struct {
+            GL_Worker_Custom_Func func;
+            void* context;
+        } custom;
+    };
+} GL_Worker_Job;
+
+typedef struct GL_Worker_Result {
+    GL_Worker_Job_Type type;
+    void* user;
+    u64 id;                 //as returned from gl_worker_submit
+    GLuint handle;          //texture, buffer or program. 0 on failure
+    bool ok;
+    GLsync fence;           //already waited for when returned from gl_worker_poll
+} GL_Worker_Result;
+
+typedef struct GL_Worker_Context {
+    void* context;
+    bool (*make_current)(void* context);    //called on the worker thread when it starts
+    void (*release_current)(void* context); //called on the worker thread before it exits
+} GL_Worker_Context;
+
+typedef struct _GL_Worker_Ring {
+    u8* items;
+    isize item_size;
+    u32 capacity;           //power of two
+    volatile i32 head;      //written only by the consumer
+    volatile i32 tail;      //written only by the producer
+} _GL_Worker_Ring;
+
+typedef struct _GL_Worker_Job_Entry {
+    GL_Worker_Job job;
+    u64 id;
+} _GL_Worker_Job_Entry;
+
+typedef struct GL_Worker {
+    GL_Worker_Context context;
+    Platform_Thread thread;
+    _GL_Worker_Ring jobs;
+    _GL_Worker_Ring results;
+    GL_Semaphore wake;      //posted on submit, on poll of a full result ring and on stop
+    u64 next_id;
+    volatile i32 should_stop;
+    volatile i32 started;   //0 while starting, 1 running, -1 failed to make the context current
+    bool is_running;
+} GL_Worker;
+
+INTERNAL void _gl_worker_ring_init(_GL_Worker_Ring* ring, isize item_size, isize capacity)
+{
+    u32 rounded = 1;
+    while(rounded < (u32) capacity)
+        rounded *= 2;
+
+    ring->items = (u8*) calloc(rounded, (size_t) item_size);
+    ring->item_size = item_size;
+    ring->capacity = rounded;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+INTERNAL isize _gl_worker_ring_count(_GL_Worker_Ring* ring)
+{
+    u32 head = (u32) platform_atomic_load32(&ring->head);
+    u32 tail = (u32) platform_atomic_load32(&ring->tail);
+    return (isize) (tail - head);
+}
+
+//Producer side. The item is written before the tail is published.
+INTERNAL bool _gl_worker_ring_push(_GL_Worker_Ring* ring, const void* item)
+{
+    u32 tail = (u32) ring->tail;
+    u32 head = (u32) platform_atomic_load32(&ring->head);
+    if(tail - head >= ring->capacity)
+        return false;
+
+    memcpy(ring->items + (tail & (ring->capacity - 1))*ring->item_size, item, (size_t) ring->item_size);
+    platform_atomic_store32(&ring->tail, (i32) (tail + 1));
+    return true;
+}
+
+//Consumer side. Returns the oldest item without removing it or NULL when empty.
+INTERNAL void* _gl_worker_ring_peek(_GL_Worker_Ring* ring)
+{
+    u32 head = (u32) ring->head;
+    u32 tail = (u32) platform_atomic_load32(&ring->tail);
+    if(head == tail)
+        return NULL;
+
+    return ring->items + (head & (ring->capacity - 1))*ring->item_size;
+}
+
+INTERNAL void _gl_worker_ring_pop(_GL_Worker_Ring* ring)
+{
+    platform_atomic_store32(&ring->head, (i32) ((u32) ring->head + 1));
+}
+
+INTERNAL GLuint _gl_worker_upload_texture(const GL_Worker_Texture_Upload* upload)
+{
+    GLenum filter = upload->filter ? upload->filter : GL_LINEAR;
+    i32 levels = MAX(upload->mip_levels, 1);
+
+    GLuint texture = 0;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, upload->format.internal_format, upload->width, upload->height);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if(upload->pixels)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, upload->width, upload->height, upload->format.access_format, upload->format.channel_type, upload->pixels);
+    if(levels > 1 && upload->pixels)
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? (filter == GL_LINEAR ? GL_LINEAR_MIPMAP_LINEAR : GL_NEAREST_MIPMAP_NEAREST) : filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+INTERNAL GLuint _gl_worker_upload_buffer(const GL_Worker_Buffer_Upload* upload)
+{
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr) upload->size, upload->data, upload->usage ? upload->usage : GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return buffer;
+}
+
+INTERNAL GLuint _gl_worker_link_program(const GL_Worker_Program* program)
+{
+    Shader_Errors errors = {0};
+    GLuint handle = shader_compile((const char**) program->sources, (GLuint*) program->stages, program->stage_count, &errors);
+
+    //shader_compile returns the program even if linking failed
+    bool failed = handle == 0;
+    for(isize i = 0; i < MAX_SHADER_STAGES; i++)
+        failed = failed || errors.errors[i] != NULL;
+
+    if(failed)
+    {
+        for(isize i = 0; i < MAX_SHADER_STAGES; i++)
+            if(errors.errors[i])
+                LOG_ERROR("SHADER", "gl_worker: %s failed with errors:\n%s", errors.stage_names[i], errors.errors[i]);
+
+        glDeleteProgram(handle);
+        handle = 0;
+    }
+    return handle;
+}
+
+INTERNAL void _gl_worker_thread(void* context)
+{
+    GL_Worker* worker = (GL_Worker*) context;
+    bool ok = worker->context.make_current(worker->context.context);
+    platform_atomic_store32(&worker->started, ok ? 1 : -1);
+    if(ok == false)
+        return;
+
+    while(platform_atomic_load32(&worker->should_stop) == 0)
+    {
+        //Only take a job when there is a place for its result so that the push below never fails
+        _GL_Worker_Job_Entry* entry = (_GL_Worker_Job_Entry*) _gl_worker_ring_peek(&worker->jobs);
+        if(entry == NULL || _gl_worker_ring_count(&worker->results) >= worker->results.capacity)
+        {
+            gl_semaphore_wait(&worker->wake);
+            continue;
+        }
+
+        GL_Worker_Result result = {0};
+        result.type = entry->job.type;
+        result.user = entry->job.user;
+        result.id = entry->id;
+        switch(entry->job.type)
+        {
+            case GL_WORKER_JOB_TEXTURE_UPLOAD: result.handle = _gl_worker_upload_texture(&entry->job.texture); break;
+            case GL_WORKER_JOB_BUFFER_UPLOAD:  result.handle = _gl_worker_upload_buffer(&entry->job.buffer); break;
+            case GL_WORKER_JOB_PROGRAM:        result.handle = _gl_worker_link_program(&entry->job.program); break;
+            case GL_WORKER_JOB_CUSTOM:         result.handle = entry->job.custom.func(entry->job.custom.context); break;
+        }
+        result.ok = result.handle != 0 || entry->job.type == GL_WORKER_JOB_CUSTOM;
+        result.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        //The fence has to reach the GPU from this context, nobody else can flush it
+        glFlush();
+        _gl_worker_ring_push(&worker->results, &result);
+        _gl_worker_ring_pop(&worker->jobs);
+    }
+
+    worker->context.release_current(worker->context.context);
+    gl_context_state_thread_exit();
+}
+
+INTERNAL void _gl_worker_delete_object(GL_Worker_Job_Type type, GLuint handle)
+{
+    switch(type)
+    {
+        case GL_WORKER_JOB_TEXTURE_UPLOAD: glDeleteTextures(1, &handle); break;
+        case GL_WORKER_JOB_BUFFER_UPLOAD:  glDeleteBuffers(1, &handle); break;
+        case GL_WORKER_JOB_PROGRAM:        glDeleteProgram(handle); break;
+        case GL_WORKER_JOB_CUSTOM:         break;
+    }
+}
+
+//Stops the worker. Jobs that were not yet executed are dropped and objects of results that were not polled are deleted.
+//Must be called from the render thread with its context current.
+void gl_worker_deinit(GL_Worker* worker)
+{
+    if(worker->is_running)
+    {
+        platform_atomic_store32(&worker->should_stop, 1);
+        gl_semaphore_post(&worker->wake, 1);
+        platform_thread_join(&worker->thread, 1);
+    }
+
+    for(GL_Worker_Result* result = NULL; (result = (GL_Worker_Result*) _gl_worker_ring_peek(&worker->results)) != NULL; )
+    {
+        glDeleteSync(result->fence);
+        _gl_worker_delete_object(result->type, result->handle);
+        _gl_worker_ring_pop(&worker->results);
+    }
+
+    //The semaphore is initialized together with the rings
+    if(worker->jobs.items)
+        gl_semaphore_deinit(&worker->wake);
+
+    free(worker->jobs.items);
+    free(worker->results.items);
+    memset(worker, 0, sizeof *worker);
+}
+
+//Starts the worker thread and waits until it has made its context current.
+//queue_capacity is the maximum number of jobs (and separately unpolled results) at once. Rounded up to a power of two.
+bool gl_worker_init(GL_Worker* worker, GL_Worker_Context context, isize queue_capacity)
+{
+    gl_worker_deinit(worker);
+    worker->context = context;
+    _gl_worker_ring_init(&worker->jobs, sizeof(_GL_Worker_Job_Entry), MAX(queue_capacity, 1));
+    _gl_worker_ring_init(&worker->results, sizeof(GL_Worker_Result), MAX(queue_capacity, 1));
+    gl_semaphore_init(&worker->wake);
+
+    worker->is_running = platform_thread_launch(&worker->thread, _gl_worker_thread, worker, 0) == 0;
+    while(worker->is_running && platform_atomic_load32(&worker->started) == 0)
+        platform_thread_sleep(1);
+
+    bool state = worker->is_running && platform_atomic_load32(&worker->started) == 1;
+    if(state == false)
+    {
+        LOG_ERROR("RENDER", "gl_worker_init: could not start the worker or make its context current");
+        gl_worker_deinit(worker);
+    }
+    return state;
+}
+
+//Queues a job. Returns its id (never 0) or 0 when the queue is full.
+u64 gl_worker_submit(GL_Worker* worker, const GL_Worker_Job* job)
+{
+    ASSERT(worker->is_running);
+    _GL_Worker_Job_Entry entry = {*job, worker->next_id + 1};
+    if(_gl_worker_ring_push(&worker->jobs, &entry) == false)
+        return 0;
+
+    gl_semaphore_post(&worker->wake, 1);
+    worker->next_id += 1;
+    return entry.id;
+}
+
+u64 gl_worker_submit_texture(GL_Worker* worker, GL_Worker_Texture_Upload upload, void* user)
+{
+    GL_Worker_Job job = {GL_WORKER_JOB_TEXTURE_UPLOAD, user};
+    job.texture = upload;
+    return gl_worker_submit(worker, &job);
+}
+
+u64 gl_worker_submit_buffer(GL_Worker* worker, GL_Worker_Buffer_Upload upload, void* user)
+{
+    GL_Worker_Job job = {GL_WORKER_JOB_BUFFER_UPLOAD, user};
+    job.buffer = upload;
+    return gl_worker_submit(worker, &job);
+}
+
+//Compiles and links vertex + fragment (+ geometry) sources. The strings must stay alive until polled.
+u64 gl_worker_submit_render_program(GL_Worker* worker, const char* vertex, const char* fragment, const char* geometry_or_null, void* user)
+{
+    GL_Worker_Job job = {GL_WORKER_JOB_PROGRAM, user};
+    job.program.sources[0] = vertex;
+    job.program.sources[1] = fragment;
+    job.program.sources[2] = geometry_or_null;
+    job.program.stages[0] = GL_VERTEX_SHADER;
+    job.program.stages[1] = GL_FRAGMENT_SHADER;
+    job.program.stages[2] = GL_GEOMETRY_SHADER;
+    job.program.stage_count = geometry_or_null ? 3 : 2;
+    return gl_worker_submit(worker, &job);
+}
+
+u64 gl_worker_submit_compute_program(GL_Worker* worker, const char* source, void* user)
+{
+    GL_Worker_Job job = {GL_WORKER_JOB_PROGRAM, user};
+    job.program.sources[0] = source;
+    job.program.stages[0] = GL_COMPUTE_SHADER;
+    job.program.stage_count = 1;
+    return gl_worker_submit(worker, &job);
+}
+
+//Returns the oldest finished result whose GPU work is complete. Never blocks.
+//The returned object is owned by the caller.
+bool gl_worker_poll(GL_Worker* worker, GL_Worker_Result* result)
+{
+    GL_Worker_Result* oldest = (GL_Worker_Result*) _gl_worker_ring_peek(&worker->results);
+    if(oldest == NULL)
+        return false;
+
+    //No flush bit: the worker has already flushed its context and flushing ours would not help
+    GLenum status = glClientWaitSync(oldest->fence, 0, 0);
+    if(status == GL_TIMEOUT_EXPIRED)
+        return false;
+
+    if(status == GL_WAIT_FAILED)
+        LOG_ERROR("RENDER", "gl_worker_poll: glClientWaitSync failed for job %llu", (unsigned long long) oldest->id);
+
+    *result = *oldest;
+    glDeleteSync(result->fence);
+    result->fence = 0;
+
+    //The worker might be waiting for a place for its next result
+    bool was_full = _gl_worker_ring_count(&worker->results) >= worker->results.capacity;
+    _gl_worker_ring_pop(&worker->results);
+    if(was_full)
+        gl_semaphore_post(&worker->wake, 1);
+    return true;
+}
+
+//Number of jobs submitted but not yet polled
+isize gl_worker_pending(GL_Worker* worker)
+{
+    return _gl_worker_ring_count(&worker->jobs) + _gl_worker_ring_count(&worker->results);
+}
+
+INTERNAL bool _gl_worker_headless_make_current(void* context)
+{
+    return gl_headless_context_make_current((GL_Headless_Context*) context);
+}
+
+INTERNAL void _gl_worker_headless_release_current(void* context)
+{
+    gl_headless_context_release_current((GL_Headless_Context*) context);
+}
+
+GL_Worker_Context gl_worker_context_headless(GL_Headless_Context* shared_context)
+{
+    GL_Worker_Context out = {shared_context, _gl_worker_headless_make_current, _gl_worker_headless_release_current};
+    return out;
+}